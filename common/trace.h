@@ -0,0 +1,39 @@
+
+/********************************************************************
+*  Licence: The MIT license
+*  Author:  See accompanied AUTHORS.txt
+*
+*  File: trace.h
+*  Description: Static tracepoints (USDT, provider 'dicthelp')
+*
+*  Built on <sys/sdt.h> when the system has it (systemtap-sdt-dev or
+*  equivalent), otherwise, or when DH_NO_TRACE is defined, they compile
+*  to nothing. An unused probe costs a single nop, see them with
+*      perf list 'sdt_dicthelp:*'   (after perf buildid-cache --add)
+*      bpftrace -l 'usdt:./dicthelp:*'
+*
+********************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#if !defined(DH_NO_TRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define DH_TRACE_ENABLED
+#endif
+#endif
+
+#ifdef DH_TRACE_ENABLED
+#define DH_TRACE1(name,a1)          DTRACE_PROBE1(dicthelp,name,a1)
+#define DH_TRACE2(name,a1,a2)       DTRACE_PROBE2(dicthelp,name,a1,a2)
+#define DH_TRACE3(name,a1,a2,a3)    DTRACE_PROBE3(dicthelp,name,a1,a2,a3)
+#else
+/* Arguments still count as used, a variable only traced draws no warning */
+#define DH_TRACE1(name,a1)          do { (void)(a1); } while(0)
+#define DH_TRACE2(name,a1,a2)       do { (void)(a1); (void)(a2); } while(0)
+#define DH_TRACE3(name,a1,a2,a3)    \
+        do { (void)(a1); (void)(a2); (void)(a3); } while(0)
+#endif
+
+#endif
@@ -5,9 +5,21 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
 
 #include "gnrcheap.h"
+#include "common/trace.h"
 
 /* constants
 ***************/
@@ -21,6 +33,57 @@
 
 #define UNKNOWN_EDIT_DISTANCE (-1)
 
+// Word signature: one bit per letter 'a'..'z', one shared bit for the rest
+#define SIGNATURE_OTHER_BIT   26
+
+// Streaming mode: the reader thread fills these many buffers of this size
+#define STREAM_CHUNK_COUNT    4
+#define STREAM_CHUNK_SIZE     (1024*1024)
+
+// Compact (front-coded) dictionary: words per block
+#define FRONTCODE_BLOCK_WORDS 32
+
+// Compressed dictionary: gzip magic bytes, and zlib's input buffer size
+#define GZIP_MAGIC            "\x1f\x8b"
+#define GZIP_BUFFER_SIZE      (256*1024)
+
+// Length-sharded dictionary: manifest and shard file names
+#define SHARD_MANIFEST        "manifest"
+#define SHARD_MANIFEST_MAGIC  "dicthelp-shards 2"
+#define SHARD_FILE_FORMAT     "len%03d.shard"
+
+// Phonetic index: Soundex keys packed as first letter and three digits
+#define SOUNDEX_OTHER         26
+#define SOUNDEX_KEYS          ((SOUNDEX_OTHER+1)*7*7*7)
+
+// Q-gram index: padded bigrams over a-z, anything else, and the padding
+#define QGRAM_OTHER           27
+#define QGRAM_SYMBOLS         (QGRAM_OTHER+1)
+#define QGRAM_KEYS            (QGRAM_SYMBOLS*QGRAM_SYMBOLS)
+
+// Adaptive mode: largest threshold tried, unless set with -e
+#define ADAPTIVE_MAX_EDITDIST_THRESHOLD 6
+
+// Size of the output buffer owned by the workspace
+#define WORKSPACE_OUTBUFF_SIZE (64*1024)
+
+// Parallel loading: most threads used
+#define MAX_LOAD_THREADS      64
+
+// Deadline: clock is checked once per these many words (a power of 2)
+#define DEADLINE_CHECK_WORDS  1024
+
+// Longest user word for the bit-parallel Damerau kernel (bits of a word)
+#define OSA_BITPARALLEL_MAX_LEN 64
+
+// Scatter/gather: most worker processes used
+#define MAX_WORKERS           64
+
+// Long-only command-line options
+#define OPT_DEADLINE_MS       256
+#define OPT_WORKERS           257
+#define OPT_SELF_JOIN         258
+
 // Default settings
 #define DEFAULT_DICT_FILE "/usr/share/dict/words"
 #define DEFAULT_EDITDIST_THRESHOLD 2
@@ -47,19 +110,249 @@ typedef struct dictword_editdist {
  
 typedef struct {
     P_EDITDIST pwordarray;
+    uint32_t  *signatures;  //Letter-set signature per word (see word_signature)
+    uint8_t   *wordlens;    //Length of each word
+    char      *arena;       //If set, holds all the words (not freed one by
+                            //one then)
     int        max_word;
     int        curr_size;   //Number of words currently held
 } VECTOR_DICTWORD, *P_VECTOR_DICTWORD;    
 
+typedef struct {
+    int    words_total;       //Dictionary words considered for the query
+    int    words_prefiltered; //Words rejected by the signature prefilter
+    int    words_scored;      //Words that went through calc_query_dist()
+    int    words_accepted;    //Words found within the threshold
+    int    words_pruned;      //Words dismissed along with a shared prefix
+    int    shards_read;       //Shards opened (sharded dictionary only)
+    int    words_unindexed;   //Words not proposed by an index
+    int    adaptive_passes;   //Passes made by the adaptive search
+    unsigned long allocs;     //Heap allocations made by the lookup itself
+    BOOL   incomplete;        //Search stopped at the deadline
+    int    words_unscanned;   //Candidates not reached before the deadline
+} SEARCH_STATS;
+
+/* Front-coded dictionary. Words are stored in blocks of
+   FRONTCODE_BLOCK_WORDS, every word encoded as 
+       <shared prefix length> <suffix length> <suffix bytes> 
+   where the shared prefix is with the previous word. The first word of a
+   block (the anchor) always has a shared prefix of 0, so any block can be
+   decoded on its own; 'blocks' holds the offset of each block in 'data' */
+typedef struct {
+    uint8_t   *data;
+    size_t     data_len;
+    size_t     data_max;
+    uint32_t  *blocks;
+    int        block_count;
+    int        block_max;
+    int        curr_size;                   //Number of words held
+    char       last[MAX_DICTWORD_LEN+1];    //Last word added
+    int        lastlen;
+} FRONTCODED_DICT, *P_FRONTCODED_DICT;
+
+typedef struct {
+    char      *shard_dir;
+    FILE      *shards[MAX_DICTWORD_LEN+1];     //Indexed by word length
+    FILE      *ordinals[MAX_DICTWORD_LEN+1];
+    uint32_t   counts[MAX_DICTWORD_LEN+1];
+    uint32_t   word_count;
+} SHARD_WRITER, *P_SHARD_WRITER;
+
+typedef struct {
+    uint32_t   ordinal;       //Position of the word in the dictionary
+    int        edit_dist;
+    char      *dict_word;
+} SHARD_RESULT;
+
+typedef struct {
+    uint32_t  *bucket_start;  //SOUNDEX_KEYS+1 offsets into word_ids
+    uint32_t  *word_ids;      //Word numbers, grouped by Soundex key
+} PHONETIC_INDEX, *P_PHONETIC_INDEX;
+
+typedef struct {
+    uint32_t  *list_start;    //QGRAM_KEYS+1 offsets into postings
+    uint8_t   *postings;      //Word numbers per bigram, varint coded gaps
+} QGRAM_INDEX, *P_QGRAM_INDEX;
+
+typedef struct {
+    char      *start;         //Byte range of the dictionary, whole lines
+    char      *end;
+    int        word_count;    //Acceptable words in the range
+    int        first;         //Vector slot of the range's first word
+    P_VECTOR_DICTWORD pv_word;
+    pthread_t  thread;
+} PARSE_RANGE, *P_PARSE_RANGE;
+
+/* Interactive lookup: DP state kept from one query to the next */
+typedef struct {
+    uint8_t   *rows;          //Last DP row of every word, back to back
+    size_t    *row_start;     //Where each word's row starts in 'rows'
+    int       *alive;         //Words still within reach, in dictionary order
+    int        alive_count;
+    PVOID     *accepted;      //Suggestions for the current query
+    char       prefix[MAX_DICTWORD_LEN+1];   //Query the rows are for
+    int        prefix_len;
+} INCREMENTAL_STATE, *P_INCREMENTAL_STATE;
+
 typedef struct {
     BOOL   help;
     BOOL   verbose;
     int    editdist_threshold; 
+    BOOL   editdist_threshold_set;  //Threshold given on the command-line
+    int    adaptive_target;   //Wanted number of suggestions, 0 if not adaptive
     char  *dict_file;
     char   output_sort_order;
     BOOL   stop_on_match;
+    BOOL   streaming;
+    BOOL   compact;
+    char  *shard_dir;         //Build a sharded dictionary here
+    BOOL   phonetic;
+    int    load_threads;      //Threads parsing the dictionary
+    BOOL   interactive;
+    int    deadline_ms;       //Time budget of a lookup, 0 if none
+    int    workers;           //Worker processes to spread the dictionary on
+    char   edit_metric;       //'l'evenshtein or 'd'amerau (transpositions)
+    BOOL   qgram;             //Look up through the bigram index
+    BOOL   self_join;         //All pairs of dictionary words, no lookup
 } PROGRAM_SETTINGS;
 
+typedef struct {
+    char      *word;          //User word (lower case)
+    int        len;
+    uint32_t   signature;
+    int        cutoff;        //Words with a larger lower bound are not scored
+    BOOL       match_found;   //User word itself is in the dictionary
+    uint64_t   deadline_ns;   //Monotonic clock deadline, 0 if none
+    uint64_t   peq[256];      //Positions of each letter in the word, one
+                              //bit each (see calc_osa_dist_bitpar)
+} QUERY, *P_QUERY;
+
+/* DP rows of the bounded kernels, all the scratch a word pair needs */
+typedef struct {
+    uint8_t    rows[3][MAX_DICTWORD_LEN+1];
+} DP_ROWS, *P_DP_ROWS;
+
+/* Scratch memory of a lookup. Sized once (see workspace_reserve) and 
+   reused from query to query, so that the lookup itself does not go to the
+   allocator. One workspace per scoring thread */
+typedef struct {
+    DP_ROWS    dp;                            //DP rows
+    uint8_t    table[MAX_DICTWORD_LEN+1][MAX_DICTWORD_LEN+1]; //Whole DP
+                                              //table, for prefix reuse
+    uint8_t   *lowerbounds;                   //One per dictionary word
+    uint32_t   lowerbounds_max;
+    int       *order;                         //Scan order, one per word
+    PVOID     *heapstore;                     //Storage for 'heap'
+    uint32_t   heapstore_max;
+    GNRCHEAP   heap;
+    char       outbuff[WORKSPACE_OUTBUFF_SIZE];  //For stdout, if attached
+} WORKSPACE, *P_WORKSPACE;
+
+typedef struct {
+    PROGRAM_SETTINGS *psettings;
+    P_WORKSPACE       pworkspace;
+    P_QUERY           pquery;
+    P_VECTOR_DICTWORD presults;  //Scored words (see search_* routines)
+    SEARCH_STATS     *pstats;
+    PGNRCHEAP_MERGE   pmerge;    //If set, relevancy order comes from here
+    PVOID            *mergeruns; //Runs being merged by pmerge
+} SEARCH_CONTEXT, *P_SEARCH_CONTEXT;
+
+/* Scatter/gather protocol. Native byte order, meant for local pipes.
+   A request is followed by the user word (len bytes), a response by
+   'count' results, each followed by its word (len bytes) */
+typedef struct {
+    uint64_t   deadline_ns;
+    int32_t    threshold;
+    int32_t    sort_order;
+    int32_t    edit_metric;
+    int32_t    len;
+} WORKER_REQUEST;
+
+typedef struct {
+    int32_t    match_found;
+    int32_t    words_total;
+    int32_t    words_prefiltered;
+    int32_t    words_scored;
+    int32_t    words_unscanned;
+    int32_t    incomplete;
+    int32_t    count;
+} WORKER_RESPONSE;
+
+typedef struct {
+    int32_t    edit_dist;
+    int32_t    len;
+} WORKER_RESULT;
+
+/* Self-join: pairs found are spilled to a temporary file per distance,
+   as positions in the length order */
+typedef struct {
+    uint32_t   first;
+    uint32_t   second;
+} JOIN_PAIR;
+
+typedef struct {
+    pthread_t          thread;
+    int                index;        //Takes every count-th word, from index
+    int                count;
+    PROGRAM_SETTINGS  *psettings;
+    P_VECTOR_DICTWORD  pv_word;
+    int               *order;        //Words by length
+    uint32_t          *signatures;   //Signatures and lengths of the words
+    uint8_t           *wordlens;     //in length order, for a tight scan
+    int               *window_end;   //First position longer than, by length
+    FILE             **spill;        //One per distance, 0 to threshold
+    unsigned long      pairs;        //Pairs within the length window
+    unsigned long      prefiltered;
+    unsigned long      scored;
+    unsigned long      found;
+    int                exitcode;
+} JOIN_WORKER, *P_JOIN_WORKER;
+
+typedef struct {
+    FILE      *fp;
+    JOIN_PAIR  pair;                 //Next pair of the file
+} JOIN_RUN, *P_JOIN_RUN;
+
+typedef ssize_t (*PFN_CHUNK_READ)(PVOID source, char *buff, size_t size);
+typedef int (*PFN_WORD_VISIT)(PVOID ctx, char *word, int len);
+
+/* Dictionary file as read by the chunk ring, gzip ones being decompressed
+   on the reader thread */
+typedef struct {
+    int        fd;
+    gzFile     gz;            //NULL if the file is not compressed
+} DICT_SOURCE, *P_DICT_SOURCE;
+
+typedef struct {
+    PFN_WORD_VISIT  pfnvisit;
+    PVOID           ctx;
+    int             word_count;
+} COUNTED_VISIT, *P_COUNTED_VISIT;
+
+typedef struct {
+    char    *data;
+    size_t   len;
+} STREAM_CHUNK;
+
+/* Bounded ring of large read buffers. A reader thread fills free chunks
+   through pfnread while the consumer parses the filled ones in order */
+typedef struct {
+    STREAM_CHUNK    chunks[STREAM_CHUNK_COUNT];
+    int             head;       //Next chunk to be consumed
+    int             tail;       //Next chunk to be filled
+    int             filled;     //Number of chunks ready for the consumer
+    BOOL            eof;        //Reader is done (end of input or error)
+    BOOL            stop;       //Consumer is not interested any more
+    int             error;      //errno of a failed read, 0 otherwise
+    PFN_CHUNK_READ  pfnread;
+    PVOID           source;
+    pthread_t       reader;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond_filled;
+    pthread_cond_t  cond_free;
+} CHUNK_RING, *P_CHUNK_RING;
+
 
 /* routines
 ****************/   
@@ -77,6 +370,10 @@ void usage()
     fprintf(stdout,"        -d <dictionary>\n");  
     fprintf(stdout,"           Specify name of the dictionary to look up the\n");
     fprintf(stdout,"           word/suggestions into\n");
+    fprintf(stdout,"           A directory built with -b is looked up "
+                               "shard by shard\n");
+    fprintf(stdout,"           A gzip-compressed dictionary is "
+                               "decompressed while being read\n");
     fprintf(stdout,"           *Default dictionary = %s\n",DEFAULT_DICT_FILE);
     fprintf(stdout,"        -s <r|a>\n");  
     fprintf(stdout,"           Set sort order of the output\n");
@@ -84,12 +381,54 @@ void usage()
                                "relevancy (edit-distance)\n");
     fprintf(stdout,"           a  sorts suggested words alphabetically\n");
     fprintf(stdout,"           *Default sort order = r\n");
+    fprintf(stdout,"        -m <levenshtein|damerau>\n");
+    fprintf(stdout,"           Set the edit-distance metric\n");
+    fprintf(stdout,"           damerau  also counts swapping two adjacent "
+                               "letters as one edit\n");
+    fprintf(stdout,"                    (teh => the), not available "
+                               "with -i\n");
+    fprintf(stdout,"           *Default metric = levenshtein\n");
     fprintf(stdout,"        -f Force suggestions.\n");
     fprintf(stdout,"           Show suggestions (similarly spelled words) "
                                "even if the supplied word is\n");
     fprintf(stdout,"           spelled correctly.\n");
     fprintf(stdout,"           *By default -f is not in effect.\n");
     fprintf(stdout,"        -v Enable verbose output\n");
+    fprintf(stdout,"        -S Stream the dictionary.\n");
+    fprintf(stdout,"           Score words while the dictionary is still "
+                               "being read and keep only\n");
+    fprintf(stdout,"           the suggestions in memory. Suits one-shot "
+                               "lookups into large dictionaries\n");
+    fprintf(stdout,"        -c Keep the dictionary compact (front-coded) "
+                               "in memory.\n");
+    fprintf(stdout,"           Lowers memory use for large dictionaries, "
+                               "sorted ones in particular\n");
+    fprintf(stdout,"        -p Suggest words that sound alike.\n");
+    fprintf(stdout,"           Only dictionary words with the same Soundex "
+                               "code as the supplied\n");
+    fprintf(stdout,"           word are ranked, which keeps high -e "
+                               "values cheap\n");
+    fprintf(stdout,"        -q Look up through a bigram index.\n");
+    fprintf(stdout,"           Only dictionary words sharing enough "
+                               "letter pairs with the supplied\n");
+    fprintf(stdout,"           word to be within -e are ranked. Same "
+                               "suggestions, fewer words scored\n");
+    fprintf(stdout,"        -i Interactive (incremental) lookup.\n");
+    fprintf(stdout,"           Every line read from stdin is a word as "
+                               "typed so far, answered with\n");
+    fprintf(stdout,"           its suggestions and an empty line. A word "
+                               "found in the dictionary\n");
+    fprintf(stdout,"           is answered with '= word' first (then "
+                               "suggestions only with -f).\n");
+    fprintf(stdout,"           Work done for a line is reused when the "
+                               "next one extends it\n");
+    fprintf(stdout,"        -j n\n");
+    fprintf(stdout,"           Parse the dictionary on n threads\n");
+    fprintf(stdout,"        -b <directory>\n");
+    fprintf(stdout,"           Split the dictionary into per-length shards "
+                               "under directory, and exit.\n");
+    fprintf(stdout,"           Lookups with -d <directory> then only read "
+                               "the shards of relevant lengths\n");
     fprintf(stdout,"        -h Show this help\n");
     fprintf(stdout,"Advanced Options:\n");
     fprintf(stdout,"        -e n\n");
@@ -101,12 +440,86 @@ void usage()
                                " (with reducing relevancy)\n");
     fprintf(stdout,"           *Default edit-distance threshold =  %d\n",
                                DEFAULT_EDITDIST_THRESHOLD);
+    fprintf(stdout,"        -n count\n");
+    fprintf(stdout,"           Adjust the edit-distance threshold "
+                               "automatically.\n");
+    fprintf(stdout,"           Threshold starts at 1 and is raised until "
+                               "at least count suggestions\n");
+    fprintf(stdout,"           are found, or it reaches the value of -e "
+                               "(%d if -e is not given).\n",
+                               ADAPTIVE_MAX_EDITDIST_THRESHOLD);
+    fprintf(stdout,"           Not with -S, -c, -p, -q, -b, -i, "
+                               "--self-join or a sharded dictionary\n");
+    fprintf(stdout,"        --deadline-ms ms\n");
+    fprintf(stdout,"           Give up the search ms milliseconds after "
+                               "start (dictionary loading\n");
+    fprintf(stdout,"           included) and show the best suggestions "
+                               "found by then. Words of\n");
+    fprintf(stdout,"           length close to the supplied word are "
+                               "looked at first (without\n");
+    fprintf(stdout,"           -S, -c, -p, -q or shards). Not with -i or "
+                               "--self-join\n");
+    fprintf(stdout,"        --workers n\n");
+    fprintf(stdout,"           Spread the dictionary over n worker "
+                               "processes, each looking up\n");
+    fprintf(stdout,"           its own part, and merge their "
+                               "suggestions. Not with -S, -c, -p\n");
+    fprintf(stdout,"           or -q\n");
+    fprintf(stdout,"        --self-join\n");
+    fprintf(stdout,"           Instead of looking a word up, show all pairs "
+                               "of dictionary words\n");
+    fprintf(stdout,"           within the edit-distance threshold, closest "
+                               "pairs first. Runs on\n");
+    fprintf(stdout,"           as many threads as given with -j\n");
     fprintf(stdout," SOME EXAMPLES:\n");
     fprintf(stdout," dicthelp happyness\n");
     fprintf(stdout," dicthelp -e3 happyness\n");
     fprintf(stdout," dicthelp -e3 -sa happyness\n");
     fprintf(stdout," dicthelp -e1 -f happy\n");
+    fprintf(stdout," dicthelp -p -e3 seperate\n");
+    fprintf(stdout," dicthelp -n10 happyness\n");
+    fprintf(stdout," dicthelp -m damerau -e1 recieve\n");
+    fprintf(stdout," dicthelp -q -e3 internationalisation\n");
+    fprintf(stdout," dicthelp --self-join -e1 -j4 -d vocabulary.txt\n");
+    fprintf(stdout," dicthelp -d %s -b /tmp/words.shards\n",
+                   DEFAULT_DICT_FILE);
+    fprintf(stdout," dicthelp -d /tmp/words.shards happyness\n");
+    fprintf(stdout," dicthelp -d /tmp/words.gz happyness\n");
+
+}
+
+
+
+/* Allocation wrappers, counting the allocations made (from any thread) */
+static unsigned long alloc_count = 0;
 
+PVOID dh_malloc(size_t size)
+{
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+PVOID dh_calloc(size_t nmemb, size_t size)
+{
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return calloc(nmemb, size);
+}
+
+PVOID dh_realloc(PVOID ptr, size_t size)
+{
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return realloc(ptr, size);
+}
+
+char *dh_strdup(const char *str)
+{
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return strdup(str);
+}
+
+unsigned long get_alloc_count()
+{
+    return __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
 }
 
 
@@ -120,13 +533,37 @@ void freewordvect(P_VECTOR_DICTWORD pv_word)
     }
 
     if(pv_word->pwordarray) {
-        for(i=0; i < pv_word->curr_size; i++) {
+        for(i=0; i < pv_word->curr_size && !pv_word->arena; i++) {
             if(pv_word->pwordarray[i].dict_word) {
                 free(pv_word->pwordarray[i].dict_word);
             }   
         }
         free(pv_word->pwordarray);
     }
+    free(pv_word->signatures);
+    free(pv_word->wordlens);
+    free(pv_word->arena);
+}
+
+
+
+uint32_t word_signature(char *word)
+{
+    uint32_t signature = 0;
+
+    /* One bit per distinct letter present in the word; anything outside
+       'a'..'z' (apostrophes, digits etc.) shares a single bit */
+    while(*word) {
+        if(*word >= 'a' && *word <= 'z') {
+            signature |= (uint32_t)1 << (*word - 'a');
+        }
+        else {
+            signature |= (uint32_t)1 << SIGNATURE_OTHER_BIT;
+        }
+        word++;
+    }
+
+    return signature;
 }
 
 
@@ -135,15 +572,22 @@ int addwordtovect(P_VECTOR_DICTWORD pv_word,
                    char *word)
 {
   void *realloc_ptr = NULL;
+  int new_max = 0;
 
   if(pv_word->max_word == pv_word->curr_size) {
-     realloc_ptr = realloc(pv_word->pwordarray,
-                           pv_word->max_word*sizeof(EDITDIST) +
-                           pv_word->max_word*2*sizeof(EDITDIST) + 
-                           1*sizeof(EDITDIST));
+     new_max = pv_word->max_word + pv_word->max_word*2 + 1;
+     realloc_ptr = dh_realloc(pv_word->pwordarray, new_max*sizeof(EDITDIST));
      if(realloc_ptr) {
        pv_word->pwordarray = realloc_ptr;
-       pv_word->max_word += pv_word->max_word*2 + 1;
+       realloc_ptr = dh_realloc(pv_word->signatures, new_max*sizeof(uint32_t));
+     }
+     if(realloc_ptr) {
+       pv_word->signatures = realloc_ptr;
+       realloc_ptr = dh_realloc(pv_word->wordlens, new_max*sizeof(uint8_t));
+     }
+     if(realloc_ptr) {
+       pv_word->wordlens = realloc_ptr;
+       pv_word->max_word = new_max;
      }
      else {
          fprintf(stderr,
@@ -152,8 +596,10 @@ int addwordtovect(P_VECTOR_DICTWORD pv_word,
          return (EXITCODE_FAIL_MEM);
      }
   }
+  pv_word->signatures[pv_word->curr_size] = word_signature(word);
+  pv_word->wordlens[pv_word->curr_size] = strlen(word);
   pv_word->pwordarray[pv_word->curr_size].edit_dist = UNKNOWN_EDIT_DISTANCE;
-  pv_word->pwordarray[pv_word->curr_size].dict_word = malloc(strlen(word)+1);;
+  pv_word->pwordarray[pv_word->curr_size].dict_word = dh_malloc(strlen(word)+1);;
   if(!pv_word->pwordarray[pv_word->curr_size].dict_word) {
       fprintf(stderr,"Memory allocation failed. Error: %s\n", strerror(errno));
       return (EXITCODE_FAIL_MEM);
@@ -166,49 +612,73 @@ int addwordtovect(P_VECTOR_DICTWORD pv_word,
 
 
 
-int calc_edit_dist(char *string1, char *string2)
+/* Edit distance, as long as it is no more than maxdist. Beyond that
+   maxdist+1 is returned as soon as a whole row exceeds maxdist (the
+   minimum of a row never decreases down the table).
+   Both strings are expected to be no longer than MAX_DICTWORD_LEN, the
+   DP rows come from the caller */
+int calc_edit_dist(P_DP_ROWS pdp,
+                   char *string1, char *string2, int maxdist)
 {
+    uint8_t *prev_row = pdp->rows[0];
+    uint8_t *curr_row = pdp->rows[1];
+    uint8_t *tmp = NULL;
+    int strlen1 = strlen(string1);
+    int strlen2 = strlen(string2);
+    int rowmin = 0;
     int i = 0;
     int j = 0;
-    int strlen1 = string1 ? strlen(string1) : 0;
-    int strlen2 = string2 ? strlen(string2) : 0;
 
-    char *prev_row = NULL;
-    char *curr_row = NULL;
-    char *tmp = NULL; 
+    for(j=0; j <= strlen2 ; j++)
+        prev_row[j] = j;
+
+    for(i = 0; i < strlen1; i ++) {
+        curr_row[0] = rowmin = i+1;
+        for(j = 0; j < strlen2; j++) {
+            if(string1[i] == string2[j]) {
+                curr_row[j+1] = prev_row[j];
+            }
+            else {
+                curr_row[j+1] = min(min(prev_row[j],prev_row[j+1]),curr_row[j]);
+                curr_row[j+1]++;
+            }
+            rowmin = min(rowmin, curr_row[j+1]);
+        }
+        if(rowmin > maxdist) {
+            return maxdist+1;
+        }
+        tmp = prev_row;
+        prev_row = curr_row;
+        curr_row = tmp;
+    }
 
-    int edit_dist = UNKNOWN_EDIT_DISTANCE;
+    return prev_row[strlen2] <= maxdist ? prev_row[strlen2] : maxdist+1;
+}
 
-    DBG_PRINTF("calc_edit_dist: Comparing %s with %s\n",string1, string2);
 
-    prev_row = malloc(strlen2 + 1);
-    if(!prev_row) {
-        return UNKNOWN_EDIT_DISTANCE;
-    }
 
-    curr_row = malloc(strlen2 + 1);
-    if(!curr_row) {
-        free(prev_row);
-        return UNKNOWN_EDIT_DISTANCE;
-    }
+/* Optimal string alignment (restricted Damerau) distance, bounded as
+   calc_edit_dist() is. Swapping two adjacent letters costs 1,
+   which takes the row before the previous one too.
+   Both strings are expected to be no longer than MAX_DICTWORD_LEN */
+int calc_osa_dist_bounded(P_DP_ROWS pdp,
+                          char *string1, char *string2, int maxdist)
+{
+    uint8_t *prev2_row = pdp->rows[0];
+    uint8_t *prev_row = pdp->rows[1];
+    uint8_t *curr_row = pdp->rows[2];
+    uint8_t *tmp = NULL;
+    int strlen1 = strlen(string1);
+    int strlen2 = strlen(string2);
+    int rowmin = 0;
+    int i = 0;
+    int j = 0;
 
-    //Initialize the very first row
     for(j=0; j <= strlen2 ; j++)
         prev_row[j] = j;
 
-    DBG_PRINTF(" \t  \t");
-    for(j=0;j<strlen2;j++)
-        DBG_PRINTF("%c\t",string2[j]); 
-
-    DBG_PRINTF("\n");
-    DBG_PRINTF(" \t");
-    for(j=0;j<=strlen2;j++)
-        DBG_PRINTF("%02d\t",prev_row[j]); 
-
     for(i = 0; i < strlen1; i ++) {
-        curr_row[0] = i+1;
-        DBG_PRINTF("\n");
-        DBG_PRINTF("%c\t%02d\t",string1[i],curr_row[0]);
+        curr_row[0] = rowmin = i+1;
         for(j = 0; j < strlen2; j++) {
             if(string1[i] == string2[j]) {
                 curr_row[j+1] = prev_row[j];
@@ -216,23 +686,77 @@ int calc_edit_dist(char *string1, char *string2)
             else {
                 curr_row[j+1] = min(min(prev_row[j],prev_row[j+1]),curr_row[j]);
                 curr_row[j+1]++;
+                if(i > 0 && j > 0 &&
+                   string1[i] == string2[j-1] && string1[i-1] == string2[j]) {
+                    curr_row[j+1] = min(curr_row[j+1], prev2_row[j-1]+1);
+                }
             }
-            DBG_PRINTF("%02d\t",curr_row[j+1]);
+            rowmin = min(rowmin, curr_row[j+1]);
         }
-        tmp = prev_row;
+        //Row minimum still never decreases: a transposition costs no
+        //less than the substitution it stands for in the previous row
+        if(rowmin > maxdist) {
+            return maxdist+1;
+        }
+        tmp = prev2_row;
+        prev2_row = prev_row;
         prev_row = curr_row;
         curr_row = tmp;
     }
 
-    edit_dist = prev_row[j];
+    return prev_row[strlen2] <= maxdist ? prev_row[strlen2] : maxdist+1;
+}
 
-    free(prev_row);
-    free(curr_row);
 
-    DBG_PRINTF("\n");
-    DBG_PRINTF("\n");
 
-    return edit_dist;
+/* Optimal string alignment distance between the user word (the pattern,
+   1 to OSA_BITPARALLEL_MAX_LEN letters) and a dictionary word, bounded as
+   calc_edit_dist() is.
+   Hyyro's bit-parallel algorithm: a whole DP column is kept as bit
+   vectors of vertical +1/-1 deltas (pv/mv) and is moved to the next
+   dictionary letter in a handful of word operations. Only the last cell
+   of the column is tracked (dist), and the lookup stops as soon as the
+   remaining letters can no longer bring it down within maxdist */
+int calc_osa_dist_bitpar(P_QUERY pquery, char *word, int maxdist)
+{
+    uint64_t hibit = 1ULL << (pquery->len - 1);
+    uint64_t pv = ~0ULL;
+    uint64_t mv = 0;
+    uint64_t d0 = 0;
+    uint64_t ph = 0;
+    uint64_t mh = 0;
+    uint64_t eq = 0;
+    uint64_t prev_eq = 0;
+    int len = strlen(word);
+    int dist = pquery->len;
+    int j = 0;
+
+    for(j=0; j < len; j++) {
+        eq = pquery->peq[(uint8_t)word[j]];
+        //Diagonal zero deltas: matches, transpositions, or carried along
+        d0 = ((((~d0) & eq) << 1) & prev_eq) |
+             (((eq & pv) + pv) ^ pv) | eq | mv;
+        ph = mv | ~(d0 | pv);
+        mh = d0 & pv;
+        if(ph & hibit) {
+            dist++;
+        }
+        else if(mh & hibit) {
+            dist--;
+        }
+        //First row of the DP table grows by 1 per letter
+        ph = (ph << 1) | 1;
+        mh = mh << 1;
+        pv = mh | ~(d0 | ph);
+        mv = ph & d0;
+        prev_eq = eq;
+
+        if(dist - (len - j - 1) > maxdist) {
+            return maxdist+1;
+        }
+    }
+
+    return dist <= maxdist ? dist : maxdist+1;
 }
 
 
@@ -252,6 +776,113 @@ void strlwr_inplace(char *str)
 
 
 
+/* Number of bits set. Plain arithmetic (SWAR) rather than
+   __builtin_popcount, which is a library call unless built with -mpopcnt
+   and keeps the loops using it from being vectorized */
+static inline int bit_count(uint32_t bits)
+{
+    bits = bits - ((bits >> 1) & 0x55555555);
+    bits = (bits & 0x33333333) + ((bits >> 2) & 0x33333333);
+    bits = (bits + (bits >> 4)) & 0x0f0f0f0f;
+
+    return (bits * 0x01010101) >> 24;
+}
+
+
+
+/* Lower bound on the edit distance between two words, from their signatures
+   and lengths alone.
+   An edit operation introduces at most one new distinct letter and gets rid
+   of at most one, hence the number of letters present in one word but absent
+   in the other can not exceed the edit distance. Neither can the difference
+   in lengths. */
+static inline int signature_lower_bound(uint32_t sig1, int len1,
+                                        uint32_t sig2, int len2)
+{
+    int lendiff = len1 > len2 ? len1 - len2 : len2 - len1;
+    int missing = bit_count(sig1 & ~sig2);
+    int extra   = bit_count(sig2 & ~sig1);
+    int bound   = lendiff > missing ? lendiff : missing;
+
+    return bound > extra ? bound : extra;
+}
+
+
+
+/* Compute, for every dictionary word, the lower bound on its edit
+   distance to the user word.
+   Kept as a plain pass over the contiguous signature and length arrays so
+   that the compiler can vectorize it. It does at -O2 with the cheap cost
+   model (see Makefile), check with -fopt-info-vec */
+void calc_lower_bounds(P_VECTOR_DICTWORD pv_word,
+                       P_QUERY pquery,
+                       uint8_t *restrict lowerbounds)
+{
+    uint32_t usersig = pquery->signature;
+    int userlen = pquery->len;
+    const uint32_t *restrict signatures = pv_word->signatures;
+    const uint8_t *restrict wordlens = pv_word->wordlens;
+    int word_count = pv_word->curr_size;   //Not reloaded past the stores
+    int i = 0;
+
+    for(i=0; i < word_count; i++) {
+        lowerbounds[i] = signature_lower_bound(usersig, userlen,
+                                               signatures[i], wordlens[i]);
+    }
+}
+
+
+
+/* Ignore following
+   - 'names' (words starting with uppercase letter)
+   - One letter long words
+   - Words too long to ever be looked up */
+BOOL dictword_acceptable(char *word, int len)
+{
+    if(isupper(word[0]) ||
+       len <= 1 ||
+       len > MAX_DICTWORD_LEN) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+
+void show_statistics(SEARCH_STATS *pstats)
+{
+  fprintf(stdout,"Statistics:\n");
+  fprintf(stdout,"  Dictionary words considered   : %d\n",
+                 pstats->words_total);
+  fprintf(stdout,"  Rejected by signature filter  : %d (%.1f%%)\n",
+                 pstats->words_prefiltered,
+                 pstats->words_total ?
+                 100.0 * pstats->words_prefiltered / pstats->words_total : 0.0);
+  fprintf(stdout,"  Scored by edit-distance       : %d\n",
+                 pstats->words_scored);
+  fprintf(stdout,"  Pruned along with a prefix    : %d\n",
+                 pstats->words_pruned);
+  fprintf(stdout,"  Within the threshold          : %d\n",
+                 pstats->words_accepted);
+  fprintf(stdout,"  Heap allocations in lookup    : %lu\n",
+                 pstats->allocs);
+  if(pstats->words_unindexed) {
+      fprintf(stdout,"  Not proposed by the index     : %d\n",
+                     pstats->words_unindexed);
+  }
+  if(pstats->adaptive_passes) {
+      fprintf(stdout,"  Adaptive passes               : %d\n",
+                     pstats->adaptive_passes);
+  }
+  if(pstats->shards_read) {
+      fprintf(stdout,"  Shards read                   : %d\n",
+                     pstats->shards_read);
+  }
+}
+
+
+
 int cmp_heap_elements(PVOID pele1, PVOID pele2)
 {
   P_EDITDIST pdist1 = (P_EDITDIST) pele1;
@@ -264,249 +895,3377 @@ int cmp_heap_elements(PVOID pele1, PVOID pele2)
     retval = strcmp(pdist1->dict_word,pdist2->dict_word);
   }
 
-  return retval; 
+  return retval;
 }
 
-void get_programsettings(int argc, char **argv, PROGRAM_SETTINGS *psettings)
+
+
+/* Chunk ring
+***************/
+
+BOOL dictionary_is_gzip(char *path)
 {
-  int opt;
+    char magic[2] = { 0 };
+    int fd = open(path, O_RDONLY);
 
-  while((opt = getopt(argc,argv,"?hvfe:s:d:")) != -1)
-  {
-      switch(opt) {
-          case 'd':
-              psettings->dict_file = optarg;
-              break;
-          case 'e':
-              psettings->editdist_threshold = atoi(optarg);
-              break;
-          case 's':
-              if((strcmp(optarg,"r")==0) ||
-                      (strcmp(optarg,"a")==0)) {
-                  psettings->output_sort_order = optarg[0];
-              }
-              break;             
-          case 'f':
-              psettings->stop_on_match = FALSE;
-              break;              
-          case 'v':
-              psettings->verbose = TRUE;
-              break;    
-          case '?':
-          case 'h':
-              psettings->help = TRUE;
-              break;              
-      }
-  }
+    if(fd < 0) {
+        return FALSE;
+    }
+    if(read(fd, magic, sizeof(magic)) != sizeof(magic)) {
+        magic[0] = '\0';
+    }
+    close(fd);
 
+    return (memcmp(magic, GZIP_MAGIC, sizeof(magic)) == 0);
 }
 
-/* main 
-****************/
-int main(int argc, char **argv)
+
+
+int dict_source_open(P_DICT_SOURCE psource, char *path)
 {
-  FILE *fp = NULL;
-  char readbuff[MAX_DICTWORD_LEN+1];
-  char userword[MAX_DICTWORD_LEN+1];
-  int dictwordlen=0;
-  signed int i=0;
-  int exitcode = EXITCODE_SUCCESS; 
-  BOOL match_found = FALSE;
+    psource->gz = NULL;
+    psource->fd = open(path, O_RDONLY);
+    if(psource->fd >= 0 && dictionary_is_gzip(path)) {
+        psource->gz = gzdopen(psource->fd, "rb");
+        if(!psource->gz) {
+            close(psource->fd);
+            psource->fd = -1;
+        }
+        else {
+            gzbuffer(psource->gz, GZIP_BUFFER_SIZE);
+        }
+    }
 
-  P_EDITDIST pworddist = NULL;
-  PGNRCHEAP pheap = NULL;
+    if(psource->fd < 0) {
+        fprintf(stderr, "Failure opening file %s. Error: %s\n",
+                        path,
+                        strerror(errno));
+        return (EXITCODE_FAIL_FILE);
+    }
 
-  PROGRAM_SETTINGS settings = 
-  {
-      .help               = FALSE,
-      .verbose            = FALSE,
-      .editdist_threshold = DEFAULT_EDITDIST_THRESHOLD,
-      .output_sort_order  = 'r',
-      .dict_file          = DEFAULT_DICT_FILE,
-      .stop_on_match      = TRUE
-  };
+    return (EXITCODE_SUCCESS);
+}
 
-  VECTOR_DICTWORD v_word = 
-   {  
-      .pwordarray = NULL, 
-      .max_word   = 0, 
-      .curr_size  = 0 
-   };
 
 
-  /* Field command-line arguments */
-  get_programsettings(argc,argv,&settings);
+void dict_source_close(P_DICT_SOURCE psource)
+{
+    if(psource->gz) {
+        gzclose(psource->gz);      //Closes fd too
+    }
+    else if(psource->fd >= 0) {
+        close(psource->fd);
+    }
+}
 
-  /* If 'help' is requested or incorrect arguments passed ... */
-  if(settings.help) {
-      usage();
-      return (EXITCODE_SUCCESS);
-  }
 
-  /* Get hold of the word user is interested in */
-  if(optind < argc) {
-      //User has supplied the word on command-line
-      strncpy(userword,argv[optind],sizeof(userword)-1);
-      userword[sizeof(userword)-1] = '\0'; //Handle with grace, if 
-                                           //user-supplied word is too long
-  }
-  else {
-      //User has not supplied the word on command-line, read thru stdin
-      fgets(userword,sizeof(userword),stdin);       
-      i = strlen(userword);
-      if(userword[i-1] == '\n') {
-          userword[i-1] = '\0'; 
-      }
- 
-  }
 
+ssize_t chunk_read_source(PVOID source, char *buff, size_t size)
+{
+    P_DICT_SOURCE psource = (P_DICT_SOURCE) source;
+    int gzerrnum = Z_OK;
+    int nread = 0;
 
-  /* Convert user word to lower case */
-  strlwr_inplace(userword);
+    if(!psource->gz) {
+        return read(psource->fd, buff, size);
+    }
 
+    nread = gzread(psource->gz, buff, size);
+    if(nread == 0) {
+        //A truncated file ends like a complete one, but for the error
+        gzerror(psource->gz, &gzerrnum);
+        nread = (gzerrnum == Z_OK || gzerrnum == Z_STREAM_END) ? 0 : -1;
+    }
+    if(nread < 0) {
+        errno = EIO;               //Corrupted or truncated
+    }
 
-  /* Open the dictionary file */
-  fp = fopen(settings.dict_file,"r");
-  if(!fp) {
-    fprintf(stderr, "Failure opening file %s. Error: %s\n",
-                    settings.dict_file,
-                    strerror(errno));
-    return (EXITCODE_FAIL_FILE);
-  } 
+    return nread;
+}
+
+
+
+void *chunk_ring_reader(void *arg)
+{
+    P_CHUNK_RING pring = (P_CHUNK_RING) arg;
+    STREAM_CHUNK *pchunk = NULL;
+    ssize_t nread = 0;
+
+    while(1) {
+        pthread_mutex_lock(&pring->lock);
+        while(pring->filled == STREAM_CHUNK_COUNT && !pring->stop) {
+            pthread_cond_wait(&pring->cond_free, &pring->lock);
+        }
+        if(pring->stop) {
+            pthread_mutex_unlock(&pring->lock);
+            break;
+        }
+        pchunk = &pring->chunks[pring->tail];
+        pthread_mutex_unlock(&pring->lock);
+
+        /* The chunk at 'tail' is owned by the reader until it is
+           published, fill it up as much as the input allows */
+        pchunk->len = 0;
+        do {
+            nread = (*pring->pfnread)(pring->source,
+                                      pchunk->data + pchunk->len,
+                                      STREAM_CHUNK_SIZE - pchunk->len);
+            if(nread > 0) {
+                pchunk->len += nread;
+            }
+        } while(nread > 0 && pchunk->len < STREAM_CHUNK_SIZE);
+
+        pthread_mutex_lock(&pring->lock);
+        if(pchunk->len) {
+            pring->tail = (pring->tail + 1) % STREAM_CHUNK_COUNT;
+            pring->filled++;
+        }
+        if(nread <= 0) {
+            pring->error = nread < 0 ? errno : 0;
+            pring->eof = TRUE;
+        }
+        pthread_cond_signal(&pring->cond_filled);
+        pthread_mutex_unlock(&pring->lock);
+
+        if(nread <= 0) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+int chunk_ring_start(P_CHUNK_RING pring, PFN_CHUNK_READ pfnread, PVOID source)
+{
+    int i = 0;
+
+    memset(pring, 0, sizeof(*pring));
+    for(i=0; i < STREAM_CHUNK_COUNT; i++) {
+        pring->chunks[i].data = dh_malloc(STREAM_CHUNK_SIZE);
+        if(!pring->chunks[i].data) {
+            while(i--) {
+                free(pring->chunks[i].data);
+            }
+            return (EXITCODE_FAIL_MEM);
+        }
+    }
+    pring->pfnread = pfnread;
+    pring->source  = source;
+    pthread_mutex_init(&pring->lock, NULL);
+    pthread_cond_init(&pring->cond_filled, NULL);
+    pthread_cond_init(&pring->cond_free, NULL);
+
+    if(pthread_create(&pring->reader, NULL, chunk_ring_reader, pring)) {
+        for(i=0; i < STREAM_CHUNK_COUNT; i++) {
+            free(pring->chunks[i].data);
+        }
+        return (EXITCODE_FAIL_MEM);
+    }
+
+    return (EXITCODE_SUCCESS);
+}
+
+
+
+void chunk_ring_finish(P_CHUNK_RING pring)
+{
+    int i = 0;
+
+    /* Let the reader go, should it still be waiting for a free chunk */
+    pthread_mutex_lock(&pring->lock);
+    pring->stop = TRUE;
+    pthread_cond_signal(&pring->cond_free);
+    pthread_mutex_unlock(&pring->lock);
+
+    pthread_join(pring->reader, NULL);
+
+    pthread_mutex_destroy(&pring->lock);
+    pthread_cond_destroy(&pring->cond_filled);
+    pthread_cond_destroy(&pring->cond_free);
+    for(i=0; i < STREAM_CHUNK_COUNT; i++) {
+        free(pring->chunks[i].data);
+    }
+}
+
+
+
+/* Returns the next filled chunk, or NULL once the input is exhausted */
+STREAM_CHUNK *chunk_ring_get(P_CHUNK_RING pring)
+{
+    STREAM_CHUNK *pchunk = NULL;
+
+    pthread_mutex_lock(&pring->lock);
+    while(pring->filled == 0 && !pring->eof) {
+        pthread_cond_wait(&pring->cond_filled, &pring->lock);
+    }
+    if(pring->filled) {
+        pchunk = &pring->chunks[pring->head];
+    }
+    pthread_mutex_unlock(&pring->lock);
+
+    return pchunk;
+}
+
+
+
+void chunk_ring_release(P_CHUNK_RING pring)
+{
+    pthread_mutex_lock(&pring->lock);
+    pring->head = (pring->head + 1) % STREAM_CHUNK_COUNT;
+    pring->filled--;
+    pthread_cond_signal(&pring->cond_free);
+    pthread_mutex_unlock(&pring->lock);
+}
+
+
+
+/* Split the chunks flowing through the ring into lines and hand every
+   acceptable dictionary word over to pfnvisit.
+   Lines lying wholly within a chunk are visited in place, only the ones
+   straddling two chunks get copied */
+int chunk_ring_foreach_word(P_CHUNK_RING pring,
+                            PFN_WORD_VISIT pfnvisit,
+                            PVOID ctx)
+{
+    STREAM_CHUNK *pchunk = NULL;
+    char line[MAX_DICTWORD_LEN+1];
+    int linelen = 0;
+    BOOL overlong = FALSE;
+    char *cp = NULL;
+    char *end = NULL;
+    char *newline = NULL;
+    size_t seglen = 0;
+    int exitcode = EXITCODE_SUCCESS;
+
+    while(exitcode == EXITCODE_SUCCESS && (pchunk = chunk_ring_get(pring))) {
+        cp  = pchunk->data;
+        end = pchunk->data + pchunk->len;
+
+        while(exitcode == EXITCODE_SUCCESS && cp < end) {
+            newline = memchr(cp, '\n', end - cp);
+            seglen  = (newline ? newline : end) - cp;
+
+            if(newline && linelen == 0 && !overlong) {
+                /* Common case: the whole line is in this chunk */
+                *newline = '\0';
+                if(dictword_acceptable(cp, seglen)) {
+                    exitcode = (*pfnvisit)(ctx, cp, seglen);
+                }
+                cp = newline + 1;
+                continue;
+            }
+
+            /* Line continues from, or into, another chunk */
+            if(!overlong) {
+                if(linelen + seglen > MAX_DICTWORD_LEN) {
+                    overlong = TRUE;
+                } else {
+                    memcpy(line + linelen, cp, seglen);
+                    linelen += seglen;
+                }
+            }
+            if(newline) {
+                line[linelen] = '\0';
+                if(!overlong && dictword_acceptable(line, linelen)) {
+                    exitcode = (*pfnvisit)(ctx, line, linelen);
+                }
+                linelen  = 0;
+                overlong = FALSE;
+                cp = newline + 1;
+            }
+            else {
+                cp = end;
+            }
+        }
+        chunk_ring_release(pring);
+    }
+
+    /* Last line of the input may not be terminated by a newline */
+    if(exitcode == EXITCODE_SUCCESS && linelen && !overlong) {
+        line[linelen] = '\0';
+        if(dictword_acceptable(line, linelen)) {
+            exitcode = (*pfnvisit)(ctx, line, linelen);
+        }
+    }
+
+    if(exitcode == EXITCODE_SUCCESS && pring->error) {
+        fprintf(stderr, "Failure reading the dictionary. Error: %s\n",
+                        strerror(pring->error));
+        exitcode = EXITCODE_FAIL_FILE;
+    }
+
+    return exitcode;
+}
+
+
+
+/* Searching
+***************/
+
+void init_query(P_QUERY pquery, char *userword, int threshold)
+{
+    int i = 0;
+
+    pquery->word        = userword;
+    pquery->len         = strlen(userword);
+    pquery->signature   = word_signature(userword);
+    pquery->match_found = FALSE;
+    pquery->deadline_ns = 0;
+
+    memset(pquery->peq, 0, sizeof(pquery->peq));
+    for(i=0; i < pquery->len && i < OSA_BITPARALLEL_MAX_LEN; i++) {
+        pquery->peq[(uint8_t)userword[i]] |= 1ULL << i;
+    }
+
+    /* An exact match (bound 0) must still be detected, whatever the
+       threshold */
+    pquery->cutoff      = threshold > 0 ? threshold : 0;
+}
+
+
+
+int note_edit_dist(P_SEARCH_CONTEXT pctx, int edit_dist);
+
+
+
+/* Distance between a query word and a dictionary word in the given
+   metric, as long as it is no more than maxdist (maxdist+1 beyond) */
+int calc_dist(P_QUERY pquery, P_DP_ROWS pdp, char edit_metric,
+              char *dict_word, int maxdist)
+{
+    if(edit_metric != 'd') {
+        return calc_edit_dist(pdp, pquery->word, dict_word, maxdist);
+    }
+    if(pquery->len > 0 && pquery->len <= OSA_BITPARALLEL_MAX_LEN) {
+        return calc_osa_dist_bitpar(pquery, dict_word, maxdist);
+    }
+    return calc_osa_dist_bounded(pdp, pquery->word, dict_word, maxdist);
+}
+
+
+
+/* Distance between the user word and a dictionary word, in the metric
+   asked for, as long as it is no more than maxdist (maxdist+1 beyond) */
+int calc_query_dist(P_SEARCH_CONTEXT pctx, char *dict_word, int maxdist)
+{
+    return calc_dist(pctx->pquery, &pctx->pworkspace->dp,
+                     pctx->psettings->edit_metric, dict_word, maxdist);
+}
+
+
+
+/* Edit distance of a word that made it past the prefilter */
+int score_candidate(P_SEARCH_CONTEXT pctx, char *dict_word)
+{
+    int edit_dist = calc_query_dist(pctx, dict_word, pctx->pquery->cutoff);
+
+    pctx->pstats->words_scored++;
+    if(edit_dist <= pctx->psettings->editdist_threshold) {
+        DH_TRACE2(candidate__accept, dict_word, edit_dist);
+    }
+    else {
+        DH_TRACE2(candidate__reject, dict_word, edit_dist);
+    }
+
+    return note_edit_dist(pctx, edit_dist);
+}
+
+
+
+/* Takes note of the user word being found in the dictionary, and counts
+   the words within the threshold */
+int note_edit_dist(P_SEARCH_CONTEXT pctx, int edit_dist)
+{
+    P_QUERY pquery = pctx->pquery;
+
+    if(edit_dist == 0 && !pquery->match_found) {
+        //Edit distance is ZERO, means an exact match was found in
+        //the dictionary, means the user supplied word is spelled
+        //correctly
+        pquery->match_found = TRUE;
+    }
+    else if(edit_dist > 0 &&
+            edit_dist <= pctx->psettings->editdist_threshold) {
+        pctx->pstats->words_accepted++;
+    }
+
+    return edit_dist;
+}
+
+
+
+/* Monotonic clock, in nanoseconds */
+uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+/* Whether the query ran out of time, n being the number of words looked
+   at so far. The clock is only read every DEADLINE_CHECK_WORDS words, and
+   once the deadline has passed the search is marked incomplete */
+BOOL deadline_passed(P_SEARCH_CONTEXT pctx, int n)
+{
+    if(pctx->pquery->deadline_ns && !pctx->pstats->incomplete &&
+       (n & (DEADLINE_CHECK_WORDS-1)) == 0 &&
+       now_ns() >= pctx->pquery->deadline_ns) {
+        pctx->pstats->incomplete = TRUE;
+    }
+
+    return pctx->pstats->incomplete;
+}
+
+
+
+/* Order the words by how far their length is from the user word's, the
+   likeliest candidates coming first. Dictionary order is kept among words
+   equally far */
+void order_by_length(P_VECTOR_DICTWORD pv_word, P_QUERY pquery, int *order)
+{
+    int start[MAX_DICTWORD_LEN+2];
+    int lendiff = 0;
+    int i = 0;
+
+    memset(start, 0, sizeof(start));
+    for(i=0; i < pv_word->curr_size; i++) {
+        lendiff = pv_word->wordlens[i] - pquery->len;
+        lendiff = lendiff < 0 ? -lendiff : lendiff;
+        start[lendiff+1]++;
+    }
+    for(i=1; i <= MAX_DICTWORD_LEN+1; i++) {
+        start[i] += start[i-1];
+    }
+    for(i=0; i < pv_word->curr_size; i++) {
+        lendiff = pv_word->wordlens[i] - pquery->len;
+        lendiff = lendiff < 0 ? -lendiff : lendiff;
+        order[start[lendiff]++] = i;
+    }
+}
+
+
+
+/* One pass over an in-memory dictionary at the given cutoff, in the given
+   order (dictionary order if NULL). Stops short at the deadline if any. Words already
+   scored are left alone and so are the ones whose lower bound exceeds the
+   cutoff. Failing words have their lower bound raised to what the DP
+   found out, for a later pass at a larger cutoff to make use of */
+void search_vector_pass(P_SEARCH_CONTEXT pctx,
+                        uint8_t *lowerbounds,
+                        int *order,
+                        int cutoff)
+{
+    P_VECTOR_DICTWORD pv_word = pctx->presults;
+    P_EDITDIST pworddist = NULL;
+    int edit_dist = 0;
+    int n = 0;
+    int i = 0;
+
+    pctx->pstats->words_prefiltered = 0;
+
+    for(n=0; n < pv_word->curr_size; n++) {
+        if(deadline_passed(pctx, n)) {
+            break;
+        }
+
+        i = order ? order[n] : n;
+        pworddist = &pv_word->pwordarray[i];
+        if(pworddist->edit_dist != UNKNOWN_EDIT_DISTANCE) {
+            continue;
+        }
+        if(lowerbounds[i] > cutoff) {
+            //Can not be within the cutoff, skip the expensive part
+            pctx->pstats->words_prefiltered++;
+            DH_TRACE2(candidate__reject, pworddist->dict_word,
+                      lowerbounds[i]);
+            continue;
+        }
+
+        edit_dist = calc_query_dist(pctx, pworddist->dict_word, cutoff);
+        pctx->pstats->words_scored++;
+        if(edit_dist <= cutoff) {
+            DH_TRACE2(candidate__accept, pworddist->dict_word, edit_dist);
+            pworddist->edit_dist = note_edit_dist(pctx, edit_dist);
+        }
+        else {
+            DH_TRACE2(candidate__reject, pworddist->dict_word, edit_dist);
+            lowerbounds[i] = edit_dist;
+        }
+    }
+}
+
+
+
+/* Score all words of an in-memory dictionary. Each word's edit distance
+   (or a lower bound of it, larger than the threshold) is left in the
+   vector itself.
+   In adaptive mode the cutoff starts at 1 and grows until enough
+   suggestions are found, each pass only rescoring the words which failed
+   the previous one and still could make it. The threshold ends up at the
+   cutoff of the last pass */
+int search_vector(P_SEARCH_CONTEXT pctx)
+{
+    PROGRAM_SETTINGS *psettings = pctx->psettings;
+    P_VECTOR_DICTWORD pv_word = pctx->presults;
+    P_QUERY pquery = pctx->pquery;
+    uint8_t *lowerbounds = pctx->pworkspace->lowerbounds;
+    int *order = NULL;
+    int max_cutoff = 0;
+    int i = 0;
+
+    if(pctx->pworkspace->lowerbounds_max < pv_word->curr_size) {
+        return (EXITCODE_FAIL_MEM);     //Workspace not reserved
+    }
+
+    for(i=0; i < pv_word->curr_size; i++) {
+        pv_word->pwordarray[i].edit_dist = UNKNOWN_EDIT_DISTANCE;
+    }
+
+    /* Prefilter: cheap lower bounds on edit distance of all words */
+    calc_lower_bounds(pv_word, pquery, lowerbounds);
+    pctx->pstats->words_total = pv_word->curr_size;
+
+    /* Against a deadline, go for the likeliest words first */
+    if(pquery->deadline_ns) {
+        order = pctx->pworkspace->order;
+        order_by_length(pv_word, pquery, order);
+    }
+
+    if(psettings->adaptive_target > 0) {
+        max_cutoff = psettings->editdist_threshold_set ?
+                     psettings->editdist_threshold :
+                     ADAPTIVE_MAX_EDITDIST_THRESHOLD;
+        pquery->cutoff = 0;
+        do {
+            pquery->cutoff++;
+            psettings->editdist_threshold = pquery->cutoff;
+            search_vector_pass(pctx, lowerbounds, order, pquery->cutoff);
+            pctx->pstats->adaptive_passes++;
+        } while(pctx->pstats->words_accepted < psettings->adaptive_target &&
+                pquery->cutoff < max_cutoff &&
+                !pctx->pstats->incomplete &&
+                !(pquery->match_found && psettings->stop_on_match));
+    }
+    else {
+        /* Calculate edit distance for each dictionary words v/s user word */
+        search_vector_pass(pctx, lowerbounds, order, pquery->cutoff);
+    }
+
+    /* Words not within the cutoff get their (larger) lower bound. Those
+       the deadline did not let us score are out too */
+    for(i=0; i < pv_word->curr_size; i++) {
+        if(pv_word->pwordarray[i].edit_dist == UNKNOWN_EDIT_DISTANCE) {
+            if(lowerbounds[i] > pquery->cutoff) {
+                pv_word->pwordarray[i].edit_dist = lowerbounds[i];
+            }
+            else {
+                pv_word->pwordarray[i].edit_dist = pquery->cutoff + 1;
+                pctx->pstats->words_unscanned++;
+            }
+        }
+    }
+
+    return (EXITCODE_SUCCESS);
+}
+
+
+
+/* Result vector of the modes which do not hold the dictionary as a vector
+   only gets the suggestions */
+int keep_result(P_SEARCH_CONTEXT pctx, char *word, int edit_dist)
+{
+    P_VECTOR_DICTWORD presults = pctx->presults;
+    int exitcode = EXITCODE_SUCCESS;
+
+    if(edit_dist > 0 && edit_dist <= pctx->psettings->editdist_threshold) {
+        exitcode = addwordtovect(presults, word);
+        if(exitcode == EXITCODE_SUCCESS) {
+            presults->pwordarray[presults->curr_size-1].edit_dist = edit_dist;
+        }
+    }
+
+    return exitcode;
+}
+
+
+
+int stream_visit_word(PVOID ctx, char *word, int len)
+{
+    P_SEARCH_CONTEXT pctx = (P_SEARCH_CONTEXT) ctx;
+    P_QUERY pquery = pctx->pquery;
+    int bound = 0;
+    int edit_dist = 0;
+
+    pctx->pstats->words_total++;
+
+    /* Past the deadline the rest of the dictionary is only counted */
+    if(deadline_passed(pctx, pctx->pstats->words_total - 1)) {
+        pctx->pstats->words_unscanned++;
+        return (EXITCODE_SUCCESS);
+    }
+
+    bound = signature_lower_bound(pquery->signature, pquery->len,
+                                  word_signature(word), len);
+    if(bound > pquery->cutoff) {
+        pctx->pstats->words_prefiltered++;
+        DH_TRACE2(candidate__reject, word, bound);
+        return (EXITCODE_SUCCESS);
+    }
+
+    /* Only the words within the threshold are kept */
+    edit_dist = score_candidate(pctx, word);
+
+    return keep_result(pctx, word, edit_dist);
+}
+
+
+
+/* Score the dictionary while it is being read. The reader thread keeps
+   large buffers coming through the chunk ring, and only the words within
+   the threshold end up in the result vector */
+int search_stream(P_SEARCH_CONTEXT pctx)
+{
+    CHUNK_RING ring;
+    DICT_SOURCE source;
+    int exitcode = EXITCODE_SUCCESS;
+
+    exitcode = dict_source_open(&source, pctx->psettings->dict_file);
+    if(exitcode != EXITCODE_SUCCESS) {
+        return exitcode;
+    }
+
+    exitcode = chunk_ring_start(&ring, chunk_read_source, &source);
+    if(exitcode == EXITCODE_SUCCESS) {
+        exitcode = chunk_ring_foreach_word(&ring, stream_visit_word, pctx);
+        chunk_ring_finish(&ring);
+    }
+
+    dict_source_close(&source);
+
+    return exitcode;
+}
+
+
+
+int counted_visit_word(PVOID ctx, char *word, int len)
+{
+    P_COUNTED_VISIT pcounted = (P_COUNTED_VISIT) ctx;
+
+    pcounted->word_count++;
+
+    return (*pcounted->pfnvisit)(pcounted->ctx, word, len);
+}
+
+
+
+/* Read a gzip dictionary: the chunk ring's reader thread decompresses
+   while this one hands the words over to pfnvisit */
+int load_dictionary_gzip(PROGRAM_SETTINGS *psettings,
+                         PFN_WORD_VISIT pfnvisit,
+                         PVOID ctx)
+{
+    CHUNK_RING ring;
+    DICT_SOURCE source;
+    COUNTED_VISIT counted = { pfnvisit, ctx, 0 };
+    int exitcode = EXITCODE_SUCCESS;
+
+    DH_TRACE1(load__start, psettings->dict_file);
+
+    exitcode = dict_source_open(&source, psettings->dict_file);
+    if(exitcode != EXITCODE_SUCCESS) {
+        return exitcode;
+    }
+
+    exitcode = chunk_ring_start(&ring, chunk_read_source, &source);
+    if(exitcode == EXITCODE_SUCCESS) {
+        exitcode = chunk_ring_foreach_word(&ring, counted_visit_word,
+                                           &counted);
+        chunk_ring_finish(&ring);
+    }
+
+    dict_source_close(&source);
+
+    DH_TRACE3(load__end, psettings->dict_file, counted.word_count, exitcode);
+
+    return exitcode;
+}
+
+
+
+/* Read the dictionary and hand every acceptable word over to pfnvisit */
+int load_dictionary(PROGRAM_SETTINGS *psettings,
+                    PFN_WORD_VISIT pfnvisit,
+                    PVOID ctx)
+{
+  FILE *fp = NULL;
+  char readbuff[MAX_DICTWORD_LEN+2];    //Longest word and its '\n'
+  int dictwordlen=0;
+  int c=0;
+  int word_count=0;
+  int exitcode = EXITCODE_SUCCESS;
+
+  if(dictionary_is_gzip(psettings->dict_file)) {
+      return load_dictionary_gzip(psettings, pfnvisit, ctx);
+  }
+
+  DH_TRACE1(load__start, psettings->dict_file);
+
+  /* Open the dictionary file */
+  fp = fopen(psettings->dict_file,"r");
+  if(!fp) {
+    fprintf(stderr, "Failure opening file %s. Error: %s\n",
+                    psettings->dict_file,
+                    strerror(errno));
+    return (EXITCODE_FAIL_FILE);
+  }
 
 
   /* Read all dictionary words */
   while(fgets(readbuff,sizeof(readbuff),fp)) {
 
-      /* Remove the CR '\n' at the end of each word */
-      dictwordlen = strlen(readbuff);
-      if(readbuff[dictwordlen-1] == '\n') {
-          readbuff[--dictwordlen] = '\0'; 
+      /* Remove the CR '\n' at the end of each word */
+      dictwordlen = strlen(readbuff);
+      if(readbuff[dictwordlen-1] == '\n') {
+          readbuff[--dictwordlen] = '\0';
+      }
+      else if(dictwordlen > MAX_DICTWORD_LEN) {
+          /* Too long a line is dropped whole, as the other loaders do,
+             not split into several words */
+          while((c = fgetc(fp)) != EOF && c != '\n');
+          continue;
+      }
+
+      if(!dictword_acceptable(readbuff, dictwordlen)) {
+              continue;
+      }
+
+      /* Add each word to the dictionary */
+      exitcode = (*pfnvisit)(ctx, readbuff, dictwordlen);
+      if(exitcode != EXITCODE_SUCCESS)
+          break;
+      word_count++;
+  }
+
+  /* Close the dictionary file */
+  fclose(fp);
+
+  DH_TRACE3(load__end, psettings->dict_file, word_count, exitcode);
+
+  return (exitcode);
+}
+
+
+
+int vector_visit_word(PVOID ctx, char *word, int len)
+{
+  return addwordtovect((P_VECTOR_DICTWORD) ctx, word);
+}
+
+
+
+/* Freeze the vector (free unused memory) */
+void freezewordvect(P_VECTOR_DICTWORD pv_word)
+{
+  DBG_PRINTF("Total words = %d\n",pv_word->curr_size);
+  DBG_PRINTF("Curr vector capacity = %d\n",pv_word->max_word);
+
+  pv_word->pwordarray = dh_realloc(pv_word->pwordarray,
+          pv_word->curr_size * sizeof(EDITDIST));
+  pv_word->signatures = dh_realloc(pv_word->signatures,
+          pv_word->curr_size * sizeof(uint32_t));
+  pv_word->wordlens = dh_realloc(pv_word->wordlens,
+          pv_word->curr_size * sizeof(uint8_t));
+  pv_word->max_word = pv_word->curr_size;
+}
+
+
+
+/* Parallel loading
+*********************/
+
+/* Phase one: count the acceptable words of a range, touching nothing */
+void *parse_range_count(void *arg)
+{
+    P_PARSE_RANGE prange = (P_PARSE_RANGE) arg;
+    char *cp = prange->start;
+    char *newline = NULL;
+
+    prange->word_count = 0;
+    while(cp < prange->end) {
+        newline = memchr(cp, '\n', prange->end - cp);
+        if(!newline) {
+            newline = prange->end;
+        }
+        if(dictword_acceptable(cp, newline - cp)) {
+            prange->word_count++;
+        }
+        cp = newline + 1;
+    }
+
+    return NULL;
+}
+
+
+
+/* Phase two: terminate the words in place and fill the range's own slice
+   of the vector */
+void *parse_range_fill(void *arg)
+{
+    P_PARSE_RANGE prange = (P_PARSE_RANGE) arg;
+    P_VECTOR_DICTWORD pv_word = prange->pv_word;
+    int i = prange->first;
+    char *cp = prange->start;
+    char *newline = NULL;
+    int len = 0;
+
+    while(cp < prange->end) {
+        newline = memchr(cp, '\n', prange->end - cp);
+        if(!newline) {
+            newline = prange->end;
+        }
+        len = newline - cp;
+        if(dictword_acceptable(cp, len)) {
+            *newline = '\0';
+            pv_word->pwordarray[i].edit_dist = UNKNOWN_EDIT_DISTANCE;
+            pv_word->pwordarray[i].dict_word = cp;
+            pv_word->signatures[i] = word_signature(cp);
+            pv_word->wordlens[i] = len;
+            i++;
+        }
+        cp = newline + 1;
+    }
+
+    return NULL;
+}
+
+
+
+int run_parse_threads(P_PARSE_RANGE ranges, int range_count,
+                      void *(*pfnparse)(void *))
+{
+    int i = 0;
+    int exitcode = EXITCODE_SUCCESS;
+
+    for(i=1; i < range_count; i++) {
+        if(pthread_create(&ranges[i].thread, NULL, pfnparse, &ranges[i])) {
+            exitcode = EXITCODE_FAIL_MEM;
+            break;
+        }
+    }
+    range_count = i;
+
+    /* The calling thread takes the first range */
+    (*pfnparse)(&ranges[0]);
+
+    for(i=1; i < range_count; i++) {
+        pthread_join(ranges[i].thread, NULL);
+    }
+
+    return exitcode;
+}
+
+
+
+/* Load the whole dictionary file into one buffer, split that into byte
+   ranges ending on line boundaries and parse the ranges on several
+   threads. Threads first count their words, so that each one can then
+   fill its own slice of the vector directly, in file order. Words stay
+   where they are in the buffer, which the vector keeps as its arena */
+int load_dictionary_parallel(PROGRAM_SETTINGS *psettings,
+                             P_VECTOR_DICTWORD pv_word)
+{
+    PARSE_RANGE ranges[MAX_LOAD_THREADS];
+    int range_count = psettings->load_threads;
+    struct stat st;
+    char *buff = NULL;
+    char *cp = NULL;
+    size_t size = 0;
+    ssize_t nread = 0;
+    int word_count = 0;
+    int exitcode = EXITCODE_SUCCESS;
+    int fd = -1;
+    int i = 0;
+
+    DH_TRACE1(load__start, psettings->dict_file);
+
+    fd = open(psettings->dict_file, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "Failure opening file %s. Error: %s\n",
+                        psettings->dict_file,
+                        strerror(errno));
+        if(fd >= 0) {
+            close(fd);
+        }
+        return (EXITCODE_FAIL_FILE);
+    }
+
+    /* One extra byte terminates the last word, newline or not */
+    buff = dh_malloc(st.st_size + 1);
+    if(!buff) {
+        fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                       strerror(errno));
+        close(fd);
+        return (EXITCODE_FAIL_MEM);
+    }
+    while(size < (size_t)st.st_size &&
+          (nread = read(fd, buff + size, st.st_size - size)) > 0) {
+        size += nread;
+    }
+    close(fd);
+    if(nread < 0) {
+        fprintf(stderr, "Failure reading file %s. Error: %s\n",
+                        psettings->dict_file,
+                        strerror(errno));
+        free(buff);
+        return (EXITCODE_FAIL_FILE);
+    }
+    buff[size] = '\0';
+
+    /* Cut into ranges of about the same size, on line boundaries */
+    if(range_count > MAX_LOAD_THREADS) {
+        range_count = MAX_LOAD_THREADS;
+    }
+    cp = buff;
+    for(i=0; i < range_count; i++) {
+        ranges[i].pv_word = pv_word;
+        ranges[i].start = cp;
+        cp = buff + size * (i+1) / range_count;
+        if(cp < ranges[i].start) {
+            cp = ranges[i].start;
+        }
+        if(i < range_count-1 && cp < buff + size) {
+            cp = memchr(cp, '\n', buff + size - cp);
+            cp = cp ? cp + 1 : buff + size;
+        }
+        else {
+            cp = buff + size;
+        }
+        ranges[i].end = cp;
+    }
+
+    exitcode = run_parse_threads(ranges, range_count, parse_range_count);
+
+    for(i=0; i < range_count; i++) {
+        ranges[i].first = word_count;
+        word_count += ranges[i].word_count;
+    }
+
+    if(exitcode == EXITCODE_SUCCESS) {
+        pv_word->pwordarray = dh_malloc((word_count+1) * sizeof(EDITDIST));
+        pv_word->signatures = dh_malloc((word_count+1) * sizeof(uint32_t));
+        pv_word->wordlens   = dh_malloc((word_count+1) * sizeof(uint8_t));
+        if(!pv_word->pwordarray || !pv_word->signatures ||
+           !pv_word->wordlens) {
+            fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                           strerror(errno));
+            exitcode = EXITCODE_FAIL_MEM;
+        }
+    }
+
+    if(exitcode == EXITCODE_SUCCESS) {
+        exitcode = run_parse_threads(ranges, range_count, parse_range_fill);
+    }
+
+    /* Hand the buffer over to the vector, even on failure, so that 
+       freewordvect() returns it */
+    pv_word->arena = buff;
+    if(exitcode == EXITCODE_SUCCESS) {
+        pv_word->curr_size = word_count;
+        pv_word->max_word  = word_count;
+    }
+
+    DH_TRACE3(load__end, psettings->dict_file, word_count, exitcode);
+
+    return exitcode;
+}
+
+
+
+/* Front-coded dictionary
+***************************/
+
+void init_frontcoded(P_FRONTCODED_DICT pfc)
+{
+    memset(pfc, 0, sizeof(*pfc));
+}
+
+
+
+void free_frontcoded(P_FRONTCODED_DICT pfc)
+{
+    free(pfc->data);
+    free(pfc->blocks);
+}
+
+
+
+int addwordtofrontcoded(P_FRONTCODED_DICT pfc, char *word, int len)
+{
+    void *realloc_ptr = NULL;
+    int prefix = 0;
+
+    /* Every FRONTCODE_BLOCK_WORDS-th word starts a new block */
+    if(pfc->curr_size % FRONTCODE_BLOCK_WORDS == 0) {
+        if(pfc->block_count == pfc->block_max) {
+            realloc_ptr = dh_realloc(pfc->blocks,
+                                  (pfc->block_max*2 + 1)*sizeof(uint32_t));
+            if(!realloc_ptr) {
+                fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                               strerror(errno));
+                return (EXITCODE_FAIL_MEM);
+            }
+            pfc->blocks = realloc_ptr;
+            pfc->block_max = pfc->block_max*2 + 1;
+        }
+        pfc->blocks[pfc->block_count++] = pfc->data_len;
+    }
+    else {
+        while(prefix < len && prefix < pfc->lastlen &&
+              word[prefix] == pfc->last[prefix]) {
+            prefix++;
+        }
+    }
+
+    if(pfc->data_len + 2 + (len - prefix) > pfc->data_max) {
+        realloc_ptr = dh_realloc(pfc->data, pfc->data_max*2 + 4096);
+        if(!realloc_ptr) {
+            fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                           strerror(errno));
+            return (EXITCODE_FAIL_MEM);
+        }
+        pfc->data = realloc_ptr;
+        pfc->data_max = pfc->data_max*2 + 4096;
+    }
+
+    pfc->data[pfc->data_len++] = prefix;
+    pfc->data[pfc->data_len++] = len - prefix;
+    memcpy(pfc->data + pfc->data_len, word + prefix, len - prefix);
+    pfc->data_len += len - prefix;
+
+    memcpy(pfc->last + prefix, word + prefix, len - prefix + 1);
+    pfc->lastlen = len;
+    pfc->curr_size++;
+
+    return (EXITCODE_SUCCESS);
+}
+
+
+
+int frontcoded_visit_word(PVOID ctx, char *word, int len)
+{
+    return addwordtofrontcoded((P_FRONTCODED_DICT) ctx, word, len);
+}
+
+
+
+/* Free unused memory once all words are in */
+void freeze_frontcoded(P_FRONTCODED_DICT pfc)
+{
+    DBG_PRINTF("Total words = %d, encoded in %lu bytes\n",
+               pfc->curr_size, (unsigned long)pfc->data_len);
+
+    if(pfc->data_len) {
+        pfc->data = dh_realloc(pfc->data, pfc->data_len);
+        pfc->data_max = pfc->data_len;
+    }
+    if(pfc->block_count) {
+        pfc->blocks = dh_realloc(pfc->blocks,
+                              pfc->block_count * sizeof(uint32_t));
+        pfc->block_max = pfc->block_count;
+    }
+}
+
+
+
+/* Random access: decode word number 'index' into buff, starting from the
+   anchor of its block. Returns the word length, -1 if there is no such
+   word */
+int frontcoded_getword(P_FRONTCODED_DICT pfc, int index, char *buff)
+{
+    uint8_t *cp = NULL;
+    int i = 0;
+    int len = 0;
+
+    if(index < 0 || index >= pfc->curr_size) {
+        return -1;
+    }
+
+    cp = pfc->data + pfc->blocks[index / FRONTCODE_BLOCK_WORDS];
+    for(i = index % FRONTCODE_BLOCK_WORDS; i >= 0; i--) {
+        memcpy(buff + cp[0], cp + 2, cp[1]);
+        len = cp[0] + cp[1];
+        cp += 2 + cp[1];
+    }
+    buff[len] = '\0';
+
+    return len;
+}
+
+
+
+/* Score all words of a front-coded dictionary.
+   The DP runs with the dictionary word along the rows, so the rows of a 
+   prefix shared with the previous word are simply kept. Once every cell 
+   of a row exceeds the cutoff no word with that prefix can come within it,
+   and such words are skipped without looking at the rest of them */
+int search_frontcoded(P_SEARCH_CONTEXT pctx, P_FRONTCODED_DICT pfc)
+{
+    uint8_t (*rows)[MAX_DICTWORD_LEN+1] = pctx->pworkspace->table;
+    char word[MAX_DICTWORD_LEN+1];
+    P_QUERY pquery = pctx->pquery;
+    char *userword = pquery->word;
+    int userlen = pquery->len;
+    int cutoff = pquery->cutoff;
+    BOOL damerau = (pctx->psettings->edit_metric == 'd');
+    uint8_t *cp = pfc->data;
+    uint8_t *prev = NULL;
+    uint8_t *curr = NULL;
+    int prefix = 0;
+    int wordlen = 0;
+    int valid = 0;                       //rows[0..valid] are up to date
+    int pruned_at = MAX_DICTWORD_LEN+1;  //Row beyond the cutoff, if any
+    int pruned_min = 0;                  //Its minimum, a lower bound
+    int rowmin = 0;
+    int edit_dist = 0;
+    int exitcode = EXITCODE_SUCCESS;
+    int n = 0;
+    int i = 0;
+    int j = 0;
+
+    for(j=0; j <= userlen; j++) {
+        rows[0][j] = j;
+    }
+
+    pctx->pstats->words_total = pfc->curr_size;
+
+    for(n=0; n < pfc->curr_size && exitcode == EXITCODE_SUCCESS; n++) {
+        if(deadline_passed(pctx, n)) {
+            pctx->pstats->words_unscanned = pfc->curr_size - n;
+            break;
+        }
+
+        /* Decode next word over the previous one */
+        prefix  = cp[0];
+        wordlen = cp[0] + cp[1];
+        memcpy(word + prefix, cp + 2, cp[1]);
+        word[wordlen] = '\0';
+        cp += 2 + cp[1];
+
+        valid = min(valid, prefix);
+        if(pruned_at <= prefix) {
+            pctx->pstats->words_pruned++;
+            DH_TRACE2(candidate__reject, word, pruned_min);
+            continue;
+        }
+        pruned_at = MAX_DICTWORD_LEN+1;
+
+        for(i = valid; i < wordlen; i++) {
+            prev = rows[i];
+            curr = rows[i+1];
+            curr[0] = rowmin = i+1;
+            for(j = 0; j < userlen; j++) {
+                if(word[i] == userword[j]) {
+                    curr[j+1] = prev[j];
+                }
+                else {
+                    curr[j+1] = min(min(prev[j],prev[j+1]),curr[j]) + 1;
+                    if(damerau && i > 0 && j > 0 &&
+                       word[i] == userword[j-1] && word[i-1] == userword[j]) {
+                        curr[j+1] = min(curr[j+1], rows[i-1][j-1] + 1);
+                    }
+                }
+                rowmin = min(rowmin, curr[j+1]);
+            }
+            valid = i+1;
+            if(rowmin > cutoff) {
+                pruned_at = i+1;
+                pruned_min = rowmin;
+                break;
+            }
+        }
+        if(pruned_at <= wordlen) {
+            pctx->pstats->words_pruned++;
+            DH_TRACE2(candidate__reject, word, pruned_min);
+            continue;
+        }
+
+        pctx->pstats->words_scored++;
+        edit_dist = rows[wordlen][userlen];
+        if(edit_dist <= pctx->psettings->editdist_threshold) {
+            DH_TRACE2(candidate__accept, word, edit_dist);
+        }
+        else {
+            DH_TRACE2(candidate__reject, word, edit_dist);
+        }
+        edit_dist = note_edit_dist(pctx, edit_dist);
+        exitcode = keep_result(pctx, word, edit_dist);
+    }
+
+    return exitcode;
+}
+
+
+
+/* Length-sharded dictionary
+******************************/
+
+/* Preprocessing: split the dictionary into one shard file per word length.
+   A shard holds 'count' fixed width records of 'length' bytes each (no
+   separators, no terminators), zero padding up to a multiple of 4 bytes,
+   and 'count' native uint32_t ordinals giving each word's position in the
+   original dictionary. The manifest lists length, count and file name of
+   every shard */
+static inline size_t shard_ordinals_offset(uint32_t count, int len)
+{
+    return ((size_t)count * len + sizeof(uint32_t) - 1) &
+           ~(sizeof(uint32_t) - 1);
+}
+
+
+
+int shard_visit_word(PVOID ctx, char *word, int len)
+{
+    P_SHARD_WRITER pwriter = (P_SHARD_WRITER) ctx;
+    char path[PATH_MAX];
+    uint32_t ordinal = pwriter->word_count++;
+
+    if(!pwriter->shards[len]) {
+        snprintf(path, sizeof(path), "%s/" SHARD_FILE_FORMAT,
+                 pwriter->shard_dir, len);
+        pwriter->shards[len] = fopen(path, "w+");
+        if(!pwriter->shards[len]) {
+            fprintf(stderr, "Failure creating file %s. Error: %s\n",
+                            path, strerror(errno));
+            return (EXITCODE_FAIL_FILE);
+        }
+    }
+
+    /* Ordinals are parked in a temporary file per shard and appended
+       once all words are in */
+    if(!pwriter->ordinals[len]) {
+        pwriter->ordinals[len] = tmpfile();
+        if(!pwriter->ordinals[len]) {
+            fprintf(stderr, "Failure creating temporary file. Error: %s\n",
+                            strerror(errno));
+            return (EXITCODE_FAIL_FILE);
+        }
+    }
+
+    if(fwrite(word, len, 1, pwriter->shards[len]) != 1 ||
+       fwrite(&ordinal, sizeof(ordinal), 1, pwriter->ordinals[len]) != 1) {
+        fprintf(stderr, "Failure writing shard. Error: %s\n",
+                        strerror(errno));
+        return (EXITCODE_FAIL_FILE);
+    }
+    pwriter->counts[len]++;
+
+    return (EXITCODE_SUCCESS);
+}
+
+
+
+int build_shards(PROGRAM_SETTINGS *psettings)
+{
+    SHARD_WRITER writer;
+    char path[PATH_MAX];
+    char buff[4096];
+    static const char padding[sizeof(uint32_t)] = { 0 };
+    FILE *manifest = NULL;
+    size_t nread = 0;
+    int shard_count = 0;
+    int exitcode = EXITCODE_SUCCESS;
+    int len = 0;
+
+    memset(&writer, 0, sizeof(writer));
+    writer.shard_dir = psettings->shard_dir;
+
+    if(mkdir(writer.shard_dir, 0755) && errno != EEXIST) {
+        fprintf(stderr, "Failure creating directory %s. Error: %s\n",
+                        writer.shard_dir, strerror(errno));
+        return (EXITCODE_FAIL_FILE);
+    }
+
+    exitcode = load_dictionary(psettings, shard_visit_word, &writer);
+
+    snprintf(path, sizeof(path), "%s/" SHARD_MANIFEST, writer.shard_dir);
+    if(exitcode == EXITCODE_SUCCESS) {
+        manifest = fopen(path, "w");
+        if(!manifest) {
+            fprintf(stderr, "Failure creating file %s. Error: %s\n",
+                            path, strerror(errno));
+            exitcode = EXITCODE_FAIL_FILE;
+        }
+        else {
+            fprintf(manifest, "%s\n", SHARD_MANIFEST_MAGIC);
+        }
+    }
+
+    for(len=0; len <= MAX_DICTWORD_LEN; len++) {
+        if(!writer.shards[len]) {
+            continue;
+        }
+        if(exitcode == EXITCODE_SUCCESS) {
+            //Keep the ordinals aligned, for them to be read in place
+            fwrite(padding, 1, shard_ordinals_offset(writer.counts[len], len) -
+                            (size_t)writer.counts[len] * len,
+                   writer.shards[len]);
+            rewind(writer.ordinals[len]);
+            while((nread = fread(buff, 1, sizeof(buff),
+                                 writer.ordinals[len])) > 0) {
+                fwrite(buff, 1, nread, writer.shards[len]);
+            }
+            if(ferror(writer.shards[len])) {
+                fprintf(stderr, "Failure writing shard. Error: %s\n",
+                                strerror(errno));
+                exitcode = EXITCODE_FAIL_FILE;
+            }
+            else {
+                fprintf(manifest, "%d %u " SHARD_FILE_FORMAT "\n",
+                        len, writer.counts[len], len);
+                shard_count++;
+            }
+        }
+        fclose(writer.shards[len]);
+        fclose(writer.ordinals[len]);
+    }
+
+    if(manifest) {
+        fclose(manifest);
+    }
+
+    if(exitcode == EXITCODE_SUCCESS) {
+        fprintf(stdout, "Wrote %u words into %d shards under %s\n",
+                writer.word_count, shard_count, writer.shard_dir);
+    }
+
+    return exitcode;
+}
+
+
+
+int cmp_shard_results(const void *pres1, const void *pres2)
+{
+    uint32_t ord1 = ((SHARD_RESULT *)pres1)->ordinal;
+    uint32_t ord2 = ((SHARD_RESULT *)pres2)->ordinal;
+
+    return (ord1 > ord2) - (ord1 < ord2);
+}
+
+
+
+/* Score the words of one shard, mapped in read-only */
+int search_shard(P_SEARCH_CONTEXT pctx, char *shard_dir, int len,
+                 uint32_t count, char *file_name,
+                 SHARD_RESULT **ppresults, int *presult_count)
+{
+    P_QUERY pquery = pctx->pquery;
+    char path[PATH_MAX];
+    char word[MAX_DICTWORD_LEN+1];
+    struct stat st;
+    char *map = NULL;
+    uint32_t *ordinals = NULL;
+    size_t map_len = shard_ordinals_offset(count, len) +
+                     (size_t)count * sizeof(uint32_t);
+    void *realloc_ptr = NULL;
+    int bound = 0;
+    int edit_dist = 0;
+    int exitcode = EXITCODE_SUCCESS;
+    int fd = -1;
+    uint32_t i = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", shard_dir, file_name);
+    fd = open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) || (size_t)st.st_size != map_len) {
+        fprintf(stderr, "Failure opening shard %s. Error: %s\n",
+                        path, fd < 0 ? strerror(errno) : "Bad size");
+        if(fd >= 0) {
+            close(fd);
+        }
+        return (EXITCODE_FAIL_FILE);
+    }
+
+    map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "Failure mapping shard %s. Error: %s\n",
+                        path, strerror(errno));
+        return (EXITCODE_FAIL_FILE);
+    }
+    madvise(map, map_len, MADV_SEQUENTIAL);
+    ordinals = (uint32_t *)(map + shard_ordinals_offset(count, len));
+
+    word[len] = '\0';
+    for(i=0; i < count && exitcode == EXITCODE_SUCCESS; i++) {
+        if(deadline_passed(pctx, pctx->pstats->words_total)) {
+            pctx->pstats->words_unscanned += count - i;
+            break;
+        }
+        memcpy(word, map + (size_t)i * len, len);
+        pctx->pstats->words_total++;
+
+        bound = signature_lower_bound(pquery->signature, pquery->len,
+                                      word_signature(word), len);
+        if(bound > pquery->cutoff) {
+            pctx->pstats->words_prefiltered++;
+            DH_TRACE2(candidate__reject, word, bound);
+            continue;
+        }
+
+        edit_dist = score_candidate(pctx, word);
+        if(edit_dist <= 0 || 
+           edit_dist > pctx->psettings->editdist_threshold) {
+            continue;
+        }
+
+        /* Keep the ordinal along, shards are read out of dictionary 
+           order */
+        realloc_ptr = dh_realloc(*ppresults,
+                              (*presult_count + 1) * sizeof(SHARD_RESULT));
+        if(!realloc_ptr) {
+            fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                           strerror(errno));
+            exitcode = EXITCODE_FAIL_MEM;
+            break;
+        }
+        *ppresults = realloc_ptr;
+        (*ppresults)[*presult_count].ordinal = ordinals[i];
+        (*ppresults)[*presult_count].edit_dist = edit_dist;
+        (*ppresults)[*presult_count].dict_word = dh_strdup(word);
+        if(!(*ppresults)[*presult_count].dict_word) {
+            exitcode = EXITCODE_FAIL_MEM;
+            break;
+        }
+        (*presult_count)++;
+    }
+
+    munmap(map, map_len);
+
+    return exitcode;
+}
+
+
+
+/* Look up a sharded dictionary: only the shards of lengths within the 
+   cutoff of the user word's length can hold a suggestion (or the user
+   word itself), the others are not even opened */
+int search_shards(P_SEARCH_CONTEXT pctx)
+{
+    char *shard_dir = pctx->psettings->dict_file;
+    P_QUERY pquery = pctx->pquery;
+    P_VECTOR_DICTWORD presults = pctx->presults;
+    SHARD_RESULT *results = NULL;
+    int result_count = 0;
+    char path[PATH_MAX];
+    char magic[64];
+    char file_name[PATH_MAX];
+    FILE *manifest = NULL;
+    unsigned int count = 0;
+    int len = 0;
+    int exitcode = EXITCODE_SUCCESS;
+    int i = 0;
+
+    snprintf(path, sizeof(path), "%s/" SHARD_MANIFEST, shard_dir);
+    manifest = fopen(path, "r");
+    if(!manifest) {
+        fprintf(stderr, "Failure opening file %s. Error: %s\n",
+                        path, strerror(errno));
+        return (EXITCODE_FAIL_FILE);
+    }
+
+    if(!fgets(magic, sizeof(magic), manifest) ||
+       strncmp(magic, SHARD_MANIFEST_MAGIC, strlen(SHARD_MANIFEST_MAGIC))) {
+        fprintf(stderr, "%s is not a dicthelp shard manifest\n", path);
+        fclose(manifest);
+        return (EXITCODE_FAIL_FILE);
+    }
+
+    while(exitcode == EXITCODE_SUCCESS &&
+          fscanf(manifest, "%d %u %4095s", &len, &count, file_name) == 3) {
+        if(len < pquery->len - pquery->cutoff ||
+           len > pquery->len + pquery->cutoff ||
+           len <= 0 || len > MAX_DICTWORD_LEN) {
+            continue;
+        }
+        if(pctx->pstats->incomplete) {
+            //Out of time, the shard is not even opened
+            pctx->pstats->words_unscanned += count;
+            continue;
+        }
+        pctx->pstats->shards_read++;
+        exitcode = search_shard(pctx, shard_dir, len, count, file_name,
+                                &results, &result_count);
+    }
+    fclose(manifest);
+
+    /* Back to dictionary order, which the alphabetical output relies on */
+    qsort(results, result_count, sizeof(SHARD_RESULT), cmp_shard_results);
+    for(i=0; i < result_count; i++) {
+        if(exitcode == EXITCODE_SUCCESS) {
+            exitcode = addwordtovect(presults, results[i].dict_word);
+            if(exitcode == EXITCODE_SUCCESS) {
+                presults->pwordarray[presults->curr_size-1].edit_dist = 
+                                                    results[i].edit_dist;
+            }
+        }
+        free(results[i].dict_word);
+    }
+    free(results);
+
+    return exitcode;
+}
+
+
+
+/* Phonetic index
+*******************/
+
+/* Soundex key of a word, packed as 
+       (first letter)*7*7*7 + digit1*7*7 + digit2*7 + digit3
+   Words not starting with a letter share the last first-letter slot */
+int soundex_key(char *word)
+{
+    /*                          a b c d e f g h i j k l m n o p q r s t u v w x y z */
+    static const char codes[] = "01230120022455012623010202";
+    int key = 0;
+    int digits = 0;
+    char last = '0';
+    char code = '0';
+    char *cp = word;
+
+    if(*cp >= 'a' && *cp <= 'z') {
+        key  = *cp - 'a';
+        last = codes[*cp - 'a'];
+        cp++;
+    }
+    else {
+        key  = SOUNDEX_OTHER;
+    }
+
+    for(; *cp && digits < 3; cp++) {
+        if(*cp < 'a' || *cp > 'z') {
+            continue;
+        }
+        code = codes[*cp - 'a'];
+        if(*cp == 'h' || *cp == 'w') {
+            //Do not separate letters of the same code
+            continue;
+        }
+        if(code != '0' && code != last) {
+            key = key*7 + (code - '0');
+            digits++;
+        }
+        last = code;
+    }
+
+    while(digits++ < 3) {
+        key *= 7;
+    }
+
+    return key;
+}
+
+
+
+void free_phonetic_index(P_PHONETIC_INDEX pindex)
+{
+    free(pindex->bucket_start);
+    free(pindex->word_ids);
+}
+
+
+
+/* Bucket the words of the dictionary by their Soundex key. Buckets are
+   laid out back to back in word_ids (in dictionary order within each),
+   bucket_start[key] being where the bucket of key starts */
+int build_phonetic_index(P_PHONETIC_INDEX pindex, P_VECTOR_DICTWORD pv_word)
+{
+    uint32_t *fill = NULL;
+    int key = 0;
+    int i = 0;
+
+    pindex->bucket_start = dh_calloc(SOUNDEX_KEYS + 1, sizeof(uint32_t));
+    pindex->word_ids = dh_malloc((pv_word->curr_size + 1) * sizeof(uint32_t));
+    fill = dh_calloc(SOUNDEX_KEYS, sizeof(uint32_t));
+    if(!pindex->bucket_start || !pindex->word_ids || !fill) {
+        fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                       strerror(errno));
+        free(fill);
+        free_phonetic_index(pindex);
+        return (EXITCODE_FAIL_MEM);
+    }
+
+    /* Count, then place */
+    for(i=0; i < pv_word->curr_size; i++) {
+        pindex->bucket_start[soundex_key(pv_word->pwordarray[i].dict_word)+1]++;
+    }
+    for(key=0; key < SOUNDEX_KEYS; key++) {
+        pindex->bucket_start[key+1] += pindex->bucket_start[key];
+    }
+    for(i=0; i < pv_word->curr_size; i++) {
+        key = soundex_key(pv_word->pwordarray[i].dict_word);
+        pindex->word_ids[pindex->bucket_start[key] + fill[key]++] = i;
+    }
+
+    free(fill);
+
+    return (EXITCODE_SUCCESS);
+}
+
+
+
+/* Only the words sounding like the user word are scored, and the ones
+   within the threshold kept as results */
+int search_phonetic(P_SEARCH_CONTEXT pctx,
+                    P_VECTOR_DICTWORD pv_word,
+                    P_PHONETIC_INDEX pindex)
+{
+    int key = soundex_key(pctx->pquery->word);
+    uint32_t first = pindex->bucket_start[key];
+    uint32_t last = pindex->bucket_start[key+1];
+    char *dict_word = NULL;
+    int edit_dist = 0;
+    int exitcode = EXITCODE_SUCCESS;
+    uint32_t i = 0;
+
+    pctx->pstats->words_total = pv_word->curr_size;
+    pctx->pstats->words_unindexed = pv_word->curr_size - (last - first);
+
+    for(i=first; i < last && exitcode == EXITCODE_SUCCESS; i++) {
+        if(deadline_passed(pctx, i - first)) {
+            pctx->pstats->words_unscanned = last - i;
+            break;
+        }
+        dict_word = pv_word->pwordarray[pindex->word_ids[i]].dict_word;
+        edit_dist = score_candidate(pctx, dict_word);
+        exitcode = keep_result(pctx, dict_word, edit_dist);
+    }
+
+    return exitcode;
+}
+
+
+
+/* Q-gram index
+*****************/
+
+/* Symbol of a letter in a q-gram: 1-26 for a-z, QGRAM_OTHER for anything
+   else, 0 being the padding */
+static inline int qgram_symbol(char c)
+{
+    return (c >= 'a' && c <= 'z') ? c - 'a' + 1 : QGRAM_OTHER;
+}
+
+
+
+/* Distinct padded bigrams of a word, in order of first appearance.
+   Returns their number */
+int qgram_keys(char *word, int len, uint16_t *keys)
+{
+    uint8_t seen[QGRAM_KEYS/8 + 1] = { 0 };
+    int prev = 0;
+    int curr = 0;
+    int key = 0;
+    int count = 0;
+    int i = 0;
+
+    for(i=0; i <= len; i++) {
+        curr = (i < len) ? qgram_symbol(word[i]) : 0;
+        key = prev * QGRAM_SYMBOLS + curr;
+        if(!(seen[key/8] & (1 << (key%8)))) {
+            seen[key/8] |= 1 << (key%8);
+            keys[count++] = key;
+        }
+        prev = curr;
+    }
+
+    return count;
+}
+
+
+
+void free_qgram_index(P_QGRAM_INDEX pindex)
+{
+    free(pindex->list_start);
+    free(pindex->postings);
+}
+
+
+
+static inline uint8_t *put_varint(uint8_t *cp, uint32_t value)
+{
+    while(value >= 0x80) {
+        *cp++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *cp++ = value;
+
+    return cp;
+}
+
+
+
+static inline int varint_size(uint32_t value)
+{
+    int size = 1;
+
+    while(value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+
+
+/* Posting list of every bigram of the (padded) dictionary words: the
+   numbers of the words having it, ascending, stored as varint coded gaps.
+   Sized in a first pass, filled in a second one */
+int build_qgram_index(P_QGRAM_INDEX pindex, P_VECTOR_DICTWORD pv_word)
+{
+    uint16_t keys[MAX_DICTWORD_LEN+1];
+    uint32_t *last_id = NULL;
+    uint32_t *fill = NULL;
+    uint8_t *cp = NULL;
+    int count = 0;
+    int key = 0;
+    int i = 0;
+    int k = 0;
+
+    pindex->list_start = dh_calloc(QGRAM_KEYS + 1, sizeof(uint32_t));
+    last_id = dh_calloc(QGRAM_KEYS, sizeof(uint32_t));
+    fill = dh_calloc(QGRAM_KEYS, sizeof(uint32_t));
+    if(!pindex->list_start || !last_id || !fill) {
+        goto nomem;
+    }
+
+    /* Size each list up ... */
+    for(i=0; i < pv_word->curr_size; i++) {
+        count = qgram_keys(pv_word->pwordarray[i].dict_word,
+                           pv_word->wordlens[i], keys);
+        for(k=0; k < count; k++) {
+            pindex->list_start[keys[k]+1] += varint_size(i - last_id[keys[k]]);
+            last_id[keys[k]] = i;
+        }
+    }
+    for(key=0; key < QGRAM_KEYS; key++) {
+        pindex->list_start[key+1] += pindex->list_start[key];
+        last_id[key] = 0;
+    }
+
+    /* ... then fill it */
+    pindex->postings = dh_malloc(pindex->list_start[QGRAM_KEYS] + 1);
+    if(!pindex->postings) {
+        goto nomem;
+    }
+    for(i=0; i < pv_word->curr_size; i++) {
+        count = qgram_keys(pv_word->pwordarray[i].dict_word,
+                           pv_word->wordlens[i], keys);
+        for(k=0; k < count; k++) {
+            key = keys[k];
+            cp = pindex->postings + pindex->list_start[key] + fill[key];
+            fill[key] = put_varint(cp, i - last_id[key]) -
+                        (pindex->postings + pindex->list_start[key]);
+            last_id[key] = i;
+        }
+    }
+
+    free(last_id);
+    free(fill);
+
+    return (EXITCODE_SUCCESS);
+
+nomem:
+    fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                   strerror(errno));
+    free(last_id);
+    free(fill);
+    free_qgram_index(pindex);
+    return (EXITCODE_FAIL_MEM);
+}
+
+
+
+/* Score only the words sharing enough bigrams with the user word.
+   An edit destroys at most q (2) bigrams of the padded user word, a
+   transposition q+1, so a word within the threshold k still has at
+   least distinct_bigrams - k*q of them (q+1 for Damerau). The posting
+   lists of the user word's bigrams are decoded into per-word counters,
+   and a single pass over the counters picks the candidates. When the
+   bound drops to zero or below every word is a candidate.
+   Counters and candidates live in the workspace (lowerbounds, order),
+   results go to pctx->presults */
+int search_qgram(P_SEARCH_CONTEXT pctx,
+                 P_VECTOR_DICTWORD pv_word,
+                 P_QGRAM_INDEX pindex)
+{
+    P_QUERY pquery = pctx->pquery;
+    uint8_t *counts = pctx->pworkspace->lowerbounds;
+    int *candidates = pctx->pworkspace->order;
+    uint16_t keys[MAX_DICTWORD_LEN+1];
+    int per_edit = (pctx->psettings->edit_metric == 'd') ? 3 : 2;
+    int count = 0;
+    int needed = 0;
+    int ncandidates = 0;
+    uint8_t *cp = NULL;
+    uint8_t *end = NULL;
+    uint32_t id = 0;
+    uint32_t gap = 0;
+    int shift = 0;
+    char *dict_word = NULL;
+    int bound = 0;
+    int edit_dist = 0;
+    int exitcode = EXITCODE_SUCCESS;
+    int i = 0;
+    int k = 0;
+
+    pctx->pstats->words_total = pv_word->curr_size;
+
+    count = qgram_keys(pquery->word, pquery->len, keys);
+    needed = count - pquery->cutoff * per_edit;
+
+    memset(counts, 0, pv_word->curr_size);
+    for(k=0; k < count && needed > 0; k++) {
+        cp  = pindex->postings + pindex->list_start[keys[k]];
+        end = pindex->postings + pindex->list_start[keys[k]+1];
+        id = 0;
+        while(cp < end) {
+            gap = 0;
+            shift = 0;
+            do {
+                gap |= (uint32_t)(*cp & 0x7f) << shift;
+                shift += 7;
+            } while(*cp++ & 0x80);
+            id += gap;
+            counts[id]++;
+        }
+    }
+
+    /* Branch free, so that it runs at the speed of the counter array */
+    if(needed < 0) {
+        needed = 0;
+    }
+    for(i=0; i < pv_word->curr_size; i++) {
+        candidates[ncandidates] = i;
+        ncandidates += (counts[i] >= needed);
+    }
+    pctx->pstats->words_unindexed = pv_word->curr_size - ncandidates;
+#ifdef DH_TRACE_ENABLED
+    /* Outside the loop above, which stays branch free. Missing bigrams
+       need that many edits at least, more than the cutoff allows */
+    for(i=0; i < pv_word->curr_size; i++) {
+        if(counts[i] < needed) {
+            DH_TRACE2(candidate__reject, pv_word->pwordarray[i].dict_word,
+                      (count - counts[i] + per_edit - 1) / per_edit);
+        }
+    }
+#endif
+
+    for(i=0; i < ncandidates && exitcode == EXITCODE_SUCCESS; i++) {
+        if(deadline_passed(pctx, i)) {
+            pctx->pstats->words_unscanned = ncandidates - i;
+            break;
+        }
+        dict_word = pv_word->pwordarray[candidates[i]].dict_word;
+        bound = signature_lower_bound(pquery->signature, pquery->len,
+                                      pv_word->signatures[candidates[i]],
+                                      pv_word->wordlens[candidates[i]]);
+        if(bound > pquery->cutoff) {
+            pctx->pstats->words_prefiltered++;
+            DH_TRACE2(candidate__reject, dict_word, bound);
+            continue;
+        }
+        edit_dist = score_candidate(pctx, dict_word);
+        exitcode = keep_result(pctx, dict_word, edit_dist);
+    }
+
+    return exitcode;
+}
+
+
+
+/* Workspace
+**************/
+
+void init_workspace(P_WORKSPACE pws)
+{
+    pws->lowerbounds     = NULL;
+    pws->lowerbounds_max = 0;
+    pws->order           = NULL;
+    pws->heapstore       = NULL;
+    pws->heapstore_max   = 0;
+}
+
+
+
+void free_workspace(P_WORKSPACE pws)
+{
+    free(pws->lowerbounds);
+    free(pws->order);
+    free(pws->heapstore);
+    init_workspace(pws);
+}
+
+
+
+/* Make room for a heap of capacity elements. Only grows, so once sized
+   for the dictionary it never goes to the allocator again */
+int workspace_reserve_heap(P_WORKSPACE pws, uint32_t capacity)
+{
+    PVOID realloc_ptr = NULL;
+
+    if(capacity < pws->heapstore_max) {
+        return (EXITCODE_SUCCESS);
+    }
+
+    //NOTE: Heap operates from offset 1, hence +1
+    realloc_ptr = dh_realloc(pws->heapstore, (capacity + 1) * sizeof(PVOID));
+    if(!realloc_ptr) {
+        fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                       strerror(errno));
+        return (EXITCODE_FAIL_MEM);
+    }
+    pws->heapstore = realloc_ptr;
+    pws->heapstore_max = capacity + 1;
+
+    return (EXITCODE_SUCCESS);
+}
+
+
+
+/* Size the workspace for a dictionary of word_count words */
+int workspace_reserve(P_WORKSPACE pws, uint32_t word_count)
+{
+    PVOID realloc_ptr = NULL;
+
+    if(word_count > pws->lowerbounds_max) {
+        realloc_ptr = dh_realloc(pws->lowerbounds, word_count);
+        if(realloc_ptr) {
+            pws->lowerbounds = realloc_ptr;
+            realloc_ptr = dh_realloc(pws->order, word_count * sizeof(int));
+        }
+        if(!realloc_ptr) {
+            fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                           strerror(errno));
+            return (EXITCODE_FAIL_MEM);
+        }
+        pws->order = realloc_ptr;
+        pws->lowerbounds_max = word_count;
+    }
+
+    return workspace_reserve_heap(pws, word_count);
+}
+
+
+
+/* Load the dictionary into a vector, and size the workspace up for it */
+int load_vector(PROGRAM_SETTINGS *psettings,
+                P_VECTOR_DICTWORD pv_word,
+                P_WORKSPACE pws)
+{
+  int exitcode = EXITCODE_SUCCESS;
+
+  //A compressed dictionary can only be read from its start
+  if(psettings->load_threads > 1 &&
+     !dictionary_is_gzip(psettings->dict_file)) {
+      exitcode = load_dictionary_parallel(psettings, pv_word);
+  }
+  else {
+      exitcode = load_dictionary(psettings, vector_visit_word, pv_word);
+  }
+
+  if(exitcode == EXITCODE_SUCCESS) {
+      freezewordvect(pv_word);
+      exitcode = workspace_reserve(pws, pv_word->curr_size);
+  }
+
+  return (exitcode);
+}
+
+
+
+void show_suggestion(P_SEARCH_CONTEXT pctx, P_EDITDIST pworddist);
+int sort_suggestions(P_SEARCH_CONTEXT pctx);
+
+
+
+/* Scatter/gather
+*******************/
+
+/* Load the words of part k (of n) of the dictionary: the lines starting
+   within the k-th of n equal byte ranges of the file */
+int load_dictionary_part(PROGRAM_SETTINGS *psettings,
+                         int k, int n,
+                         P_VECTOR_DICTWORD pv_word)
+{
+    FILE *fp = NULL;
+    char *line = NULL;
+    size_t line_max = 0;
+    ssize_t len = 0;
+    off_t size = 0;
+    off_t begin = 0;
+    off_t end = 0;
+    off_t pos = 0;
+    int c = 0;
+    int exitcode = EXITCODE_SUCCESS;
+
+    DH_TRACE1(load__start, psettings->dict_file);
+
+    fp = fopen(psettings->dict_file, "r");
+    if(!fp || fseeko(fp, 0, SEEK_END)) {
+        fprintf(stderr, "Failure opening file %s. Error: %s\n",
+                        psettings->dict_file,
+                        strerror(errno));
+        if(fp) {
+            fclose(fp);
+        }
+        return (EXITCODE_FAIL_FILE);
+    }
+    size  = ftello(fp);
+    begin = size * k / n;
+    end   = size * (k+1) / n;
+
+    /* A line straddling 'begin' belongs to the previous part */
+    if(begin > 0) {
+        fseeko(fp, begin - 1, SEEK_SET);
+        while((c = fgetc(fp)) != EOF && c != '\n');
+    }
+    else {
+        rewind(fp);
+    }
+    pos = ftello(fp);
+
+    while(pos < end && (len = getline(&line, &line_max, fp)) > 0) {
+        pos += len;
+        if(line[len-1] == '\n') {
+            line[--len] = '\0';
+        }
+        if(!dictword_acceptable(line, len)) {
+            continue;
+        }
+        exitcode = addwordtovect(pv_word, line);
+        if(exitcode != EXITCODE_SUCCESS) {
+            break;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+
+    if(exitcode == EXITCODE_SUCCESS) {
+        freezewordvect(pv_word);
+    }
+
+    DH_TRACE3(load__end, psettings->dict_file, pv_word->curr_size, exitcode);
+
+    return (exitcode);
+}
+
+
+
+int read_full(FILE *fp, PVOID buff, size_t size)
+{
+    return (size == 0 || fread(buff, size, 1, fp) == 1) ?
+           EXITCODE_SUCCESS : EXITCODE_FAIL_FILE;
+}
+
+
+
+/* Worker side: hold part k of n of the dictionary and answer queries
+   coming through reqfd on respfd, until reqfd is closed.
+   Each answer carries the suggestions of the part, in relevancy or
+   dictionary order as requested, ready to be merged */
+int run_worker(P_SEARCH_CONTEXT pctx, int k, int n, int reqfd, int respfd)
+{
+    PROGRAM_SETTINGS *psettings = pctx->psettings;
+    P_VECTOR_DICTWORD pv_word = pctx->presults;
+    PGNRCHEAP pheap = &pctx->pworkspace->heap;
+    char word[MAX_DICTWORD_LEN+1];
+    WORKER_REQUEST request;
+    WORKER_RESPONSE response;
+    WORKER_RESULT result;
+    P_EDITDIST pworddist = NULL;
+    FILE *in = NULL;
+    FILE *out = NULL;
+    int exitcode = EXITCODE_SUCCESS;
+    int i = 0;
+
+    exitcode = load_dictionary_part(psettings, k, n, pv_word);
+    if(exitcode == EXITCODE_SUCCESS) {
+        exitcode = workspace_reserve(pctx->pworkspace, pv_word->curr_size);
+    }
+    if(exitcode != EXITCODE_SUCCESS) {
+        return (exitcode);
+    }
+
+    in  = fdopen(reqfd, "r");
+    out = fdopen(respfd, "w");
+    if(!in || !out) {
+        return (EXITCODE_FAIL_FILE);
+    }
+
+    while(read_full(in, &request, sizeof(request)) == EXITCODE_SUCCESS) {
+        if(request.len < 0 || request.len > MAX_DICTWORD_LEN ||
+           read_full(in, word, request.len) != EXITCODE_SUCCESS) {
+            exitcode = EXITCODE_FAIL_FILE;
+            break;
+        }
+        word[request.len] = '\0';
+
+        //Adaptive search is up to the coordinator, the threshold is fixed
+        psettings->adaptive_target    = 0;
+        psettings->editdist_threshold = request.threshold;
+        psettings->output_sort_order  = request.sort_order;
+        psettings->edit_metric        = request.edit_metric;
+        init_query(pctx->pquery, word, request.threshold);
+        pctx->pquery->deadline_ns = request.deadline_ns;
+        memset(pctx->pstats, 0, sizeof(*pctx->pstats));
+
+        DH_TRACE2(query__start, word, request.threshold);
+        exitcode = search_vector(pctx);
+        DH_TRACE3(query__end, word, pctx->pstats->words_scored,
+                  pctx->pstats->words_accepted);
+        if(exitcode == EXITCODE_SUCCESS && request.sort_order == 'r') {
+            exitcode = sort_suggestions(pctx);
+        }
+        if(exitcode != EXITCODE_SUCCESS) {
+            break;
+        }
+
+        response.match_found       = pctx->pquery->match_found;
+        response.words_total       = pctx->pstats->words_total;
+        response.words_prefiltered = pctx->pstats->words_prefiltered;
+        response.words_scored      = pctx->pstats->words_scored;
+        response.words_unscanned   = pctx->pstats->words_unscanned;
+        response.incomplete        = pctx->pstats->incomplete;
+        response.count             = pctx->pstats->words_accepted;
+        fwrite(&response, sizeof(response), 1, out);
+
+        for(i=0; i < pv_word->curr_size; i++) {
+            if(request.sort_order == 'r') {
+                pworddist = gnrcheap_getmin(pheap);
+                if(!pworddist) {
+                    break;
+                }
+                gnrcheap_delmin(pheap,NULL);
+            }
+            else {
+                pworddist = &pv_word->pwordarray[i];
+                if(pworddist->edit_dist <= 0 ||
+                   pworddist->edit_dist > request.threshold) {
+                    continue;
+                }
+            }
+            result.edit_dist = pworddist->edit_dist;
+            result.len = strlen(pworddist->dict_word);
+            fwrite(&result, sizeof(result), 1, out);
+            fwrite(pworddist->dict_word, result.len, 1, out);
+        }
+
+        if(fflush(out)) {
+            exitcode = EXITCODE_FAIL_FILE;
+            break;
+        }
+    }
+
+    fclose(in);
+    fclose(out);
+
+    return (exitcode);
+}
+
+
+
+/* Adaptive search over gathered results: the cutoff the single-process
+   search would have stopped at, given every suggestion within max_cutoff.
+   It becomes the threshold, and the counts follow it */
+void adaptive_cutoff(P_SEARCH_CONTEXT pctx, int max_cutoff)
+{
+    PROGRAM_SETTINGS *psettings = pctx->psettings;
+    P_VECTOR_DICTWORD presults = pctx->presults;
+    P_QUERY pquery = pctx->pquery;
+    int counts[MAX_DICTWORD_LEN+2];
+    int accepted = 0;
+    int i = 0;
+
+    memset(counts, 0, sizeof(counts));
+    for(i=0; i < presults->curr_size; i++) {
+        counts[presults->pwordarray[i].edit_dist]++;
+    }
+
+    pquery->cutoff = 0;
+    do {
+        pquery->cutoff++;
+        accepted += counts[pquery->cutoff];
+        pctx->pstats->adaptive_passes++;
+    } while(accepted < psettings->adaptive_target &&
+            pquery->cutoff < max_cutoff &&
+            !pctx->pstats->incomplete &&
+            !(pquery->match_found && psettings->stop_on_match));
+
+    psettings->editdist_threshold = pquery->cutoff;
+    pctx->pstats->words_accepted  = accepted;
+}
+
+
+
+/* Coordinator side: split the dictionary between worker processes, one
+   part each, send them the query and gather their suggestions. Parts are
+   in dictionary order, so are the gathered results. For the relevancy 
+   order the sorted runs of the workers are merged by gnrcheap.
+   In adaptive mode the workers answer at the largest cutoff, the one to
+   stop at being picked once all their suggestions are in */
+int search_workers(P_SEARCH_CONTEXT pctx)
+{
+    PROGRAM_SETTINGS *psettings = pctx->psettings;
+    P_QUERY pquery = pctx->pquery;
+    P_VECTOR_DICTWORD presults = pctx->presults;
+    int nworkers = psettings->workers;
+    pid_t pids[MAX_WORKERS];
+    int reqfds[MAX_WORKERS];
+    int respfds[MAX_WORKERS];
+    int runstart[MAX_WORKERS+1];
+    int reqpipe[2];
+    int resppipe[2];
+    char word[MAX_DICTWORD_LEN+1];
+    WORKER_REQUEST request;
+    WORKER_RESPONSE response;
+    WORKER_RESULT result;
+    FILE *in = NULL;
+    int max_cutoff = 0;
+    int exitcode = EXITCODE_SUCCESS;
+    int started = 0;
+    int k = 0;
+    int i = 0;
+
+    if(nworkers > MAX_WORKERS) {
+        nworkers = MAX_WORKERS;
+    }
+
+    /* A worker gone should show up as a failure, not kill us */
+    signal(SIGPIPE, SIG_IGN);
+    fflush(stdout);
+
+    for(started=0; started < nworkers; started++) {
+        if(pipe(reqpipe)) {
+            break;
+        }
+        if(pipe(resppipe)) {
+            close(reqpipe[0]);
+            close(reqpipe[1]);
+            break;
+        }
+
+        pids[started] = fork();
+        if(pids[started] == 0) {
+            /* Worker: keep its own ends of its own pipes only */
+            for(k=0; k < started; k++) {
+                close(reqfds[k]);
+                close(respfds[k]);
+            }
+            close(reqpipe[1]);
+            close(resppipe[0]);
+            _exit(run_worker(pctx, started, nworkers,
+                             reqpipe[0], resppipe[1]));
+        }
+
+        close(reqpipe[0]);
+        close(resppipe[1]);
+        if(pids[started] < 0) {
+            close(reqpipe[1]);
+            close(resppipe[0]);
+            break;
+        }
+        reqfds[started]  = reqpipe[1];
+        respfds[started] = resppipe[0];
+    }
+
+    if(started < nworkers) {
+        fprintf(stderr, "Failure starting workers. Error: %s\n",
+                        strerror(errno));
+        exitcode = EXITCODE_FAIL_MEM;
+    }
+
+    if(psettings->adaptive_target > 0 && !psettings->editdist_threshold_set) {
+        psettings->editdist_threshold = ADAPTIVE_MAX_EDITDIST_THRESHOLD;
+    }
+    max_cutoff = psettings->editdist_threshold;
+
+    /* Scatter the query ... */
+    request.deadline_ns = pquery->deadline_ns;
+    request.threshold  = psettings->editdist_threshold;
+    request.sort_order = psettings->output_sort_order;
+    request.edit_metric = psettings->edit_metric;
+    request.len        = pquery->len;
+    for(k=0; k < started && exitcode == EXITCODE_SUCCESS; k++) {
+        if(write(reqfds[k], &request, sizeof(request)) != sizeof(request) ||
+           write(reqfds[k], pquery->word, pquery->len) != pquery->len) {
+            exitcode = EXITCODE_FAIL_FILE;
+        }
+    }
+    for(k=0; k < started; k++) {
+        close(reqfds[k]);
+    }
+
+    /* ... and gather the answers */
+    for(k=0; k < started; k++) {
+        in = fdopen(respfds[k], "r");
+        if(!in) {
+            close(respfds[k]);
+            exitcode = EXITCODE_FAIL_FILE;
+            continue;
+        }
+        runstart[k] = presults->curr_size;
+        if(exitcode == EXITCODE_SUCCESS) {
+            exitcode = read_full(in, &response, sizeof(response));
+        }
+        for(i=0; i < response.count && exitcode == EXITCODE_SUCCESS; i++) {
+            exitcode = read_full(in, &result, sizeof(result));
+            if(exitcode == EXITCODE_SUCCESS &&
+               (result.len < 0 || result.len > MAX_DICTWORD_LEN)) {
+                exitcode = EXITCODE_FAIL_FILE;
+            }
+            if(exitcode == EXITCODE_SUCCESS) {
+                exitcode = read_full(in, word, result.len);
+            }
+            if(exitcode == EXITCODE_SUCCESS) {
+                word[result.len] = '\0';
+                note_edit_dist(pctx, result.edit_dist);
+                exitcode = keep_result(pctx, word, result.edit_dist);
+            }
+        }
+        if(exitcode == EXITCODE_SUCCESS) {
+            pquery->match_found |= response.match_found;
+            pctx->pstats->words_total       += response.words_total;
+            pctx->pstats->words_prefiltered += response.words_prefiltered;
+            pctx->pstats->words_scored      += response.words_scored;
+            pctx->pstats->words_unscanned   += response.words_unscanned;
+            pctx->pstats->incomplete        |= response.incomplete;
+        }
+        fclose(in);
+    }
+    runstart[started] = presults->curr_size;
+
+    for(k=0; k < started; k++) {
+        waitpid(pids[k], NULL, 0);
+    }
+
+    if(exitcode != EXITCODE_SUCCESS) {
+        fprintf(stderr, "Failure gathering results from the workers\n");
+        return (exitcode);
+    }
+
+    if(psettings->adaptive_target > 0) {
+        adaptive_cutoff(pctx, max_cutoff);
+    }
+
+    /* Runs of the workers in relevancy order, to be merged on output */
+    if(psettings->output_sort_order == 'r') {
+        pctx->mergeruns = dh_malloc((presults->curr_size + 1) * 
+                                    sizeof(PVOID));
+        pctx->pmerge = gnrcheap_merge_create(HEAP_TYPE_MIN,
+                                             started,
+                                             cmp_heap_elements);
+        if(!pctx->mergeruns || !pctx->pmerge) {
+            return (EXITCODE_FAIL_MEM);
+        }
+        for(i=0; i < presults->curr_size; i++) {
+            pctx->mergeruns[i] = &presults->pwordarray[i];
+        }
+        for(k=0; k < started; k++) {
+            gnrcheap_merge_addrun(pctx->pmerge,
+                                  &pctx->mergeruns[runstart[k]],
+                                  runstart[k+1] - runstart[k]);
+        }
+    }
+
+    return (EXITCODE_SUCCESS);
+}
+
+
+
+/* Self-join
+**************/
+
+/* Whether more than count bits are set, in count steps at most */
+static inline BOOL bits_exceed(uint32_t bits, int count)
+{
+    while(count-- > 0 && bits) {
+        bits &= bits - 1;
+    }
+
+    return (bits != 0);
+}
+
+
+
+/* Compare every word with the longer (or as long) words that follow it
+   in length order, no more than threshold letters longer. Each worker
+   takes every count-th word, pairs within the threshold are spilled to
+   the file of their distance */
+void *self_join_worker(void *arg)
+{
+    P_JOIN_WORKER pworker = (P_JOIN_WORKER) arg;
+    P_VECTOR_DICTWORD pv_word = pworker->pv_word;
+    int *order = pworker->order;
+    int threshold = pworker->psettings->editdist_threshold;
+    char edit_metric = pworker->psettings->edit_metric;
+    DP_ROWS dp;                 //The only scratch a pair needs
+    QUERY query;
+    JOIN_PAIR pair;
+    uint32_t *signatures = pworker->signatures;
+    uint8_t *wordlens = pworker->wordlens;
+    int edit_dist = 0;
+    int maxlen = 0;
+    int qend = 0;
+    int p = 0;
+    int q = 0;
+    int i = 0;
+    int j = 0;
+
+    for(p = pworker->index; p < pv_word->curr_size; p += pworker->count) {
+        i = order[p];
+        init_query(&query, pv_word->pwordarray[i].dict_word, threshold);
+        maxlen = min(wordlens[p] + threshold, MAX_DICTWORD_LEN);
+        qend = pworker->window_end[maxlen];
+        pworker->pairs += qend - (p+1);
+
+        for(q = p+1; q < qend; q++) {
+            //Lengths are within the threshold already, so is the
+            //signature bound unless either difference has more bits
+            if(bits_exceed(query.signature & ~signatures[q], threshold) ||
+               bits_exceed(signatures[q] & ~query.signature, threshold)) {
+                pworker->prefiltered++;
+                continue;
+            }
+
+            j = order[q];
+            edit_dist = calc_dist(&query, &dp, edit_metric,
+                                  pv_word->pwordarray[j].dict_word, threshold);
+            pworker->scored++;
+            if(edit_dist > threshold) {
+                continue;
+            }
+
+            pworker->found++;
+            pair.first  = p;
+            pair.second = q;
+            if(fwrite(&pair, sizeof(pair), 1, pworker->spill[edit_dist]) != 1) {
+                pworker->exitcode = EXITCODE_FAIL_FILE;
+                return NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+
+int cmp_join_runs(PVOID pele1, PVOID pele2)
+{
+    P_JOIN_RUN prun1 = (P_JOIN_RUN) pele1;
+    P_JOIN_RUN prun2 = (P_JOIN_RUN) pele2;
+
+    if(prun1->pair.first != prun2->pair.first) {
+        return prun1->pair.first < prun2->pair.first ? -1 : 1;
+    }
+    if(prun1->pair.second != prun2->pair.second) {
+        return prun1->pair.second < prun2->pair.second ? -1 : 1;
+    }
+
+    return 0;
+}
+
+
+
+/* Show the pairs of one distance. Every worker spilled its pairs in
+   increasing order, gnrcheap merges them so that the output does not
+   depend on the number of workers */
+void show_join_pairs(P_JOIN_WORKER workers, int nworkers,
+                     int edit_dist,
+                     P_VECTOR_DICTWORD pv_word, int *order,
+                     PVOID *heaparr, P_JOIN_RUN runs)
+{
+    GNRCHEAP heap;
+    P_JOIN_RUN prun = NULL;
+    int k = 0;
+
+    gnrcheap_init(&heap, HEAP_TYPE_MIN, heaparr, nworkers, cmp_join_runs);
+
+    for(k=0; k < nworkers; k++) {
+        runs[k].fp = workers[k].spill[edit_dist];
+        rewind(runs[k].fp);
+        if(fread(&runs[k].pair, sizeof(JOIN_PAIR), 1, runs[k].fp) == 1) {
+            gnrcheap_insert(&heap, &runs[k]);
+        }
+    }
+
+    while(prun = gnrcheap_getmin(&heap)) {
+        gnrcheap_delmin(&heap, NULL);
+        fprintf(stdout, "%s\t%s\tedit-dist=%d\n",
+                pv_word->pwordarray[order[prun->pair.first]].dict_word,
+                pv_word->pwordarray[order[prun->pair.second]].dict_word,
+                edit_dist);
+        if(fread(&prun->pair, sizeof(JOIN_PAIR), 1, prun->fp) == 1) {
+            gnrcheap_insert(&heap, prun);
+        }
+    }
+}
+
+
+
+/* All pairs of dictionary words within the threshold, by distance.
+   Words are put in length order so that each one is only compared with
+   the few length buckets it can be close to. Pairs go to temporary files
+   (one per worker and distance) rather than memory, and are shown once
+   all workers are done */
+int self_join(PROGRAM_SETTINGS *psettings,
+              P_VECTOR_DICTWORD pv_word,
+              P_WORKSPACE pws)
+{
+    JOIN_WORKER workers[MAX_LOAD_THREADS];
+    int nworkers = psettings->load_threads;
+    int threshold = psettings->editdist_threshold;
+    unsigned long pairs = 0;
+    unsigned long prefiltered = 0;
+    unsigned long scored = 0;
+    unsigned long found = 0;
+    QUERY byword;
+    PVOID heaparr[MAX_LOAD_THREADS+1];
+    JOIN_RUN runs[MAX_LOAD_THREADS];
+    int window_end[MAX_DICTWORD_LEN+1];
+    uint32_t *signatures = NULL;
+    uint8_t *wordlens = NULL;
+    int exitcode = EXITCODE_SUCCESS;
+    int started = 0;
+    int len = 0;
+    int k = 0;
+    int d = 0;
+    int p = 0;
+
+    if(threshold < 0) {
+        threshold = psettings->editdist_threshold = 0;
+    }
+    if(nworkers < 1) {
+        nworkers = 1;
+    }
+    if(nworkers > MAX_LOAD_THREADS) {
+        nworkers = MAX_LOAD_THREADS;
+    }
+
+    /* Length order: by distance from an empty word */
+    init_query(&byword, "", threshold);
+    order_by_length(pv_word, &byword, pws->order);
+
+    signatures = dh_malloc((pv_word->curr_size + 1) * sizeof(uint32_t));
+    wordlens = dh_malloc(pv_word->curr_size + 1);
+    if(!signatures || !wordlens) {
+        fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                       strerror(errno));
+        free(signatures);
+        free(wordlens);
+        return (EXITCODE_FAIL_MEM);
+    }
+    for(p=0; p < pv_word->curr_size; p++) {
+        signatures[p] = pv_word->signatures[pws->order[p]];
+        wordlens[p] = pv_word->wordlens[pws->order[p]];
+    }
+    for(len=0, p=0; len <= MAX_DICTWORD_LEN; len++) {
+        while(p < pv_word->curr_size && wordlens[p] <= len) {
+            p++;
+        }
+        window_end[len] = p;
+    }
+
+    for(k=0; k < nworkers; k++) {
+        memset(&workers[k], 0, sizeof(JOIN_WORKER));
+        workers[k].index      = k;
+        workers[k].count      = nworkers;
+        workers[k].psettings  = psettings;
+        workers[k].pv_word    = pv_word;
+        workers[k].order      = pws->order;
+        workers[k].signatures = signatures;
+        workers[k].wordlens   = wordlens;
+        workers[k].window_end = window_end;
+        workers[k].spill      = dh_calloc(threshold + 1, sizeof(FILE *));
+        if(!workers[k].spill) {
+            exitcode = EXITCODE_FAIL_MEM;
+            nworkers = k;
+            break;
+        }
+        for(d=0; d <= threshold; d++) {
+            workers[k].spill[d] = tmpfile();
+            if(!workers[k].spill[d]) {
+                fprintf(stderr, "Failure creating a temporary file. "
+                                "Error: %s\n", strerror(errno));
+                exitcode = EXITCODE_FAIL_FILE;
+            }
+        }
+    }
+
+    /* The calling thread is worker 0 */
+    if(exitcode == EXITCODE_SUCCESS) {
+        for(started=1; started < nworkers; started++) {
+            if(pthread_create(&workers[started].thread, NULL,
+                              self_join_worker, &workers[started])) {
+                break;
+            }
+        }
+        self_join_worker(&workers[0]);
+        for(k=1; k < started; k++) {
+            pthread_join(workers[k].thread, NULL);
+        }
+        if(started < nworkers) {
+            //Stragglers are taken over by the calling thread
+            for(k=started; k < nworkers; k++) {
+                self_join_worker(&workers[k]);
+            }
+        }
+    }
+
+    for(k=0; k < nworkers && exitcode == EXITCODE_SUCCESS; k++) {
+        exitcode = workers[k].exitcode;
+        pairs       += workers[k].pairs;
+        prefiltered += workers[k].prefiltered;
+        scored      += workers[k].scored;
+        found       += workers[k].found;
+    }
+
+    if(exitcode == EXITCODE_SUCCESS) {
+        for(d=0; d <= threshold; d++) {
+            show_join_pairs(workers, nworkers, d, pv_word, pws->order,
+                            heaparr, runs);
+        }
+    }
+    else {
+        fprintf(stderr, "Failure joining the dictionary with itself\n");
+    }
+
+    if(exitcode == EXITCODE_SUCCESS && psettings->verbose) {
+        fprintf(stdout,"Statistics:\n");
+        fprintf(stdout,"  Word pairs considered         : %lu\n", pairs);
+        fprintf(stdout,"  Rejected by signature filter  : %lu\n",
+                       prefiltered);
+        fprintf(stdout,"  Scored by edit-distance       : %lu\n", scored);
+        fprintf(stdout,"  Within the threshold          : %lu\n", found);
+    }
+
+    for(k=0; k < nworkers; k++) {
+        for(d=0; d <= threshold; d++) {
+            if(workers[k].spill[d]) {
+                fclose(workers[k].spill[d]);
+            }
+        }
+        free(workers[k].spill);
+    }
+    free(signatures);
+    free(wordlens);
+
+    return (exitcode);
+}
+
+
+
+/* Interactive lookup
+***********************/
+
+void free_incremental(P_INCREMENTAL_STATE pstate)
+{
+    free(pstate->rows);
+    free(pstate->row_start);
+    free(pstate->alive);
+    free(pstate->accepted);
+}
+
+
+
+int init_incremental(P_INCREMENTAL_STATE pstate, P_VECTOR_DICTWORD pv_word)
+{
+    size_t rows_size = 0;
+    int i = 0;
+
+    memset(pstate, 0, sizeof(*pstate));
+
+    for(i=0; i < pv_word->curr_size; i++) {
+        rows_size += pv_word->wordlens[i] + 1;
+    }
+
+    pstate->rows      = dh_malloc(rows_size + 1);
+    pstate->row_start = dh_malloc((pv_word->curr_size + 1) * sizeof(size_t));
+    pstate->alive     = dh_malloc((pv_word->curr_size + 1) * sizeof(int));
+    pstate->accepted  = dh_malloc((pv_word->curr_size + 1) * sizeof(PVOID));
+    if(!pstate->rows || !pstate->row_start ||
+       !pstate->alive || !pstate->accepted) {
+        fprintf(stderr,"Memory allocation failed. Error: %s\n",
+                       strerror(errno));
+        free_incremental(pstate);
+        return (EXITCODE_FAIL_MEM);
+    }
+
+    rows_size = 0;
+    for(i=0; i < pv_word->curr_size; i++) {
+        pstate->row_start[i] = rows_size;
+        rows_size += pv_word->wordlens[i] + 1;
+    }
+
+    return (EXITCODE_SUCCESS);
+}
+
+
+
+/* Back to the empty query: every word is a candidate again, its DP row
+   being the very first one */
+void reset_incremental(P_INCREMENTAL_STATE pstate, P_VECTOR_DICTWORD pv_word)
+{
+    uint8_t *row = NULL;
+    int i = 0;
+    int j = 0;
+
+    for(i=0; i < pv_word->curr_size; i++) {
+        row = pstate->rows + pstate->row_start[i];
+        for(j=0; j <= pv_word->wordlens[i]; j++) {
+            row[j] = j;
+        }
+        pstate->alive[i] = i;
+    }
+    pstate->alive_count = pv_word->curr_size;
+    pstate->prefix_len = 0;
+}
+
+
+
+/* Turn a word's DP row for the query into the row for the query extended
+   by c, in place. Returns the minimum of the new row */
+static inline int extend_row(uint8_t *row, char *word, int wordlen, char c)
+{
+    uint8_t diag = row[0];
+    uint8_t up = 0;
+    int rowmin = 0;
+    int j = 0;
+
+    row[0]++;
+    rowmin = row[0];
+    for(j=1; j <= wordlen; j++) {
+        up = row[j];
+        if(word[j-1] == c) {
+            row[j] = diag;
+        }
+        else {
+            row[j] = min(min(diag, up), row[j-1]) + 1;
+        }
+        diag = up;
+        rowmin = min(rowmin, row[j]);
+    }
+
+    return rowmin;
+}
+
+
+
+/* Bring the DP state from the previous query over to this one. When the
+   query extends the previous one only the new rows are computed, and only
+   for the words still alive; anything else starts over. A word whose row 
+   is all beyond the threshold can not come back with more characters, and
+   is dropped for good */
+void update_incremental(P_INCREMENTAL_STATE pstate,
+                        P_VECTOR_DICTWORD pv_word,
+                        char *query,
+                        int threshold)
+{
+    int querylen = strlen(query);
+    int word = 0;
+    int alive = 0;
+    int rowmin = 0;
+    int i = 0;
+    int k = 0;
+
+    if(querylen < pstate->prefix_len ||
+       strncmp(query, pstate->prefix, pstate->prefix_len)) {
+        reset_incremental(pstate, pv_word);
+    }
+
+    for(k = pstate->prefix_len; k < querylen; k++) {
+        alive = 0;
+        for(i=0; i < pstate->alive_count; i++) {
+            word = pstate->alive[i];
+            rowmin = extend_row(pstate->rows + pstate->row_start[word],
+                                pv_word->pwordarray[word].dict_word,
+                                pv_word->wordlens[word],
+                                query[k]);
+            if(rowmin <= threshold) {
+                pstate->alive[alive++] = word;
+            }
+        }
+        pstate->alive_count = alive;
+    }
+
+    memcpy(pstate->prefix, query, querylen + 1);
+    pstate->prefix_len = querylen;
+}
+
+
+
+/* Line protocol on stdin/stdout: every input line is the query as typed so
+   far, answered with the suggestions for it (as in a regular lookup) and 
+   an empty line. Nothing is suggested for a correctly spelled query 
+   unless -f is in effect */
+int interactive_lookup(P_SEARCH_CONTEXT pctx, P_VECTOR_DICTWORD pv_word)
+{
+    PROGRAM_SETTINGS *psettings = pctx->psettings;
+    PGNRCHEAP pheap = &pctx->pworkspace->heap;
+    INCREMENTAL_STATE state;
+    char line[MAX_DICTWORD_LEN+2];
+    P_EDITDIST pworddist = NULL;
+    BOOL match_found = FALSE;
+    int accepted = 0;
+    int threshold = psettings->editdist_threshold;
+    int edit_dist = 0;
+    int word = 0;
+    int len = 0;
+    int i = 0;
+    int c = 0;
+    int exitcode = EXITCODE_SUCCESS;
+
+    exitcode = init_incremental(&state, pv_word);
+    if(exitcode != EXITCODE_SUCCESS) {
+        return exitcode;
+    }
+    reset_incremental(&state, pv_word);
+
+    while(fgets(line, sizeof(line), stdin)) {
+        len = strlen(line);
+        if(len && line[len-1] == '\n') {
+            line[--len] = '\0';
+        }
+        else {
+            //Overlong line: the rest of it is no query of its own
+            while((c = getchar()) != EOF && c != '\n');
+        }
+        line[MAX_DICTWORD_LEN] = '\0';
+        strlwr_inplace(line);
+        pctx->pquery->word = line;
+
+        update_incremental(&state, pv_word, line, threshold);
+
+        /* Alive words are the candidates, their last DP cell being the
+           edit distance to the query */
+        accepted = 0;
+        match_found = FALSE;
+        for(i=0; i < state.alive_count; i++) {
+            word = state.alive[i];
+            edit_dist = state.rows[state.row_start[word] +
+                                   pv_word->wordlens[word]];
+            if(edit_dist == 0) {
+                match_found = TRUE;
+            }
+            else if(edit_dist <= threshold) {
+                pv_word->pwordarray[word].edit_dist = edit_dist;
+                state.accepted[accepted++] = &pv_word->pwordarray[word];
+            }
+        }
+
+        //Spelled correctly: a line of its own, unlike any suggestion
+        if(match_found) {
+            fprintf(stdout, "= %s\n", line);
+        }
+
+        if(!(match_found && psettings->stop_on_match)) {
+            if(psettings->output_sort_order == 'a') {
+                //Alive words are kept in dictionary order
+                for(i=0; i < accepted; i++) {
+                    show_suggestion(pctx, state.accepted[i]);
+                }
+            }
+            else {
+                gnrcheap_init(pheap,
+                              HEAP_TYPE_MIN,
+                              pctx->pworkspace->heapstore,
+                              accepted,
+                              cmp_heap_elements);
+                gnrcheap_insertbatch(pheap, state.accepted, accepted);
+                while(pworddist = gnrcheap_getmin(pheap)) {
+                    show_suggestion(pctx, pworddist);
+                    gnrcheap_delmin(pheap,NULL);
+                }
+            }
+        }
+
+        fprintf(stdout, "\n");
+        fflush(stdout);
+    }
+
+    free_incremental(&state);
+
+    return exitcode;
+}
+
+
+
+void show_suggestion(P_SEARCH_CONTEXT pctx, P_EDITDIST pworddist)
+{
+    if(!pctx->psettings->verbose) {
+        fprintf(stdout,"%s\n",pworddist->dict_word);
+    }
+    else {
+        fprintf(stdout,"%s\t=>\t%-15s\tedit-dist=%d\n",
+                pctx->pquery->word,
+                pworddist->dict_word,
+                pworddist->edit_dist);
+    }
+}
+
+
+
+/* Put the results within the threshold on the workspace heap */
+int sort_suggestions(P_SEARCH_CONTEXT pctx)
+{
+  P_VECTOR_DICTWORD presults = pctx->presults;
+  PGNRCHEAP pheap = &pctx->pworkspace->heap;
+  int i = 0;
+
+  if(workspace_reserve_heap(pctx->pworkspace,
+                            pctx->pstats->words_accepted) !=
+     EXITCODE_SUCCESS) {
+     return (EXITCODE_FAIL_MEM);
+  }
+  gnrcheap_init(pheap,
+                HEAP_TYPE_MIN,
+                pctx->pworkspace->heapstore,
+                pctx->pstats->words_accepted,
+                cmp_heap_elements);
+
+  for(i=0; i < presults->curr_size; i++) {
+      if(presults->pwordarray[i].edit_dist > 0 &&
+         presults->pwordarray[i].edit_dist <=
+                                  pctx->psettings->editdist_threshold) {
+          gnrcheap_insert(pheap,&presults->pwordarray[i]);
       }
+  }
+
+  return (EXITCODE_SUCCESS);
+}
 
 
-      /* Ignore following 
-         - 'names' (words starting with uppercase letter)
-         - One letter long words 
-      */
-      if(isupper(readbuff[0]) ||
-         strlen(readbuff) <= 1) {
-              continue;
+
+int show_suggestions(P_SEARCH_CONTEXT pctx)
+{
+  PROGRAM_SETTINGS *psettings = pctx->psettings;
+  P_VECTOR_DICTWORD presults = pctx->presults;
+  P_EDITDIST pworddist = NULL;
+  int i = 0;
+
+  if(pctx->pquery->match_found) {
+      //Edit distance is ZERO, means an exact match was found in
+      //the dictionary, means the user supplied word is spelled
+      //correctly
+      fprintf(stdout,"Word '%s' was found in the dictionary, "
+                     "which means it is spelled correctly.\n",
+                     pctx->pquery->word);
+      if(psettings->stop_on_match) {
+          fprintf(stdout,"To see similarly spelled words, rerun this "
+                         "program with argument -f\n");
+          return (EXITCODE_SUCCESS);
+      }
+      fprintf(stdout,"Below is the list of similarly spelled words:\n");
+  }
+
+  /* Show dictionary words and edit distances to the user word
+     in alphabetical order, if that is requested */
+  if(psettings->output_sort_order == 'a') {
+      for(i=0; i < presults->curr_size; i++) {
+          if(presults->pwordarray[i].edit_dist &&
+             presults->pwordarray[i].edit_dist <=
+                                      psettings->editdist_threshold) {
+              show_suggestion(pctx, &presults->pwordarray[i]);
+          }
       }
+  }
 
 
-      /* Add each word to the vector */
-      exitcode = addwordtovect(&v_word, readbuff);
-      if(exitcode != EXITCODE_SUCCESS)       
-          break;
+  /* Show dictionary words and edit distances to the user word
+     in relevancy order (edit distance), if that is requested */
+  if(psettings->output_sort_order == 'r' && pctx->pmerge) {
+      //Runs may go beyond an adaptive threshold, which ends the output
+      while((pworddist = gnrcheap_merge_next(pctx->pmerge)) &&
+            pworddist->edit_dist <= psettings->editdist_threshold)
+      {
+          show_suggestion(pctx, pworddist);
+      }
   }
+  else if(psettings->output_sort_order == 'r') {
+      if(sort_suggestions(pctx) != EXITCODE_SUCCESS) {
+         return (EXITCODE_FAIL_MEM);
+      }
 
-  /* Close the dictionary file */
-  fclose(fp);
+      while(pworddist = gnrcheap_getmin(&pctx->pworkspace->heap))
+      {
+          show_suggestion(pctx, pworddist);
+          gnrcheap_delmin(&pctx->pworkspace->heap,NULL);
+      }
+  }
+
+  return (EXITCODE_SUCCESS);
+}
+
+
+
+void get_programsettings(int argc, char **argv, PROGRAM_SETTINGS *psettings)
+{
+  static struct option long_options[] =
+  {
+      { "deadline-ms", required_argument, NULL, OPT_DEADLINE_MS },
+      { "workers",     required_argument, NULL, OPT_WORKERS },
+      { "self-join",   no_argument,       NULL, OPT_SELF_JOIN },
+      { NULL,          0,                 NULL, 0 }
+  };
+  int opt;
 
-  /* Check if any error occured in the while() loop*/
-  if(exitcode != EXITCODE_SUCCESS) 
+  while((opt = getopt_long(argc,argv,"?hvfScpiqe:n:s:d:b:j:m:",
+                           long_options,NULL)) != -1)
   {
-      freewordvect(&v_word);
-      return (exitcode);
+      switch(opt) {
+          case OPT_DEADLINE_MS:
+              psettings->deadline_ms = atoi(optarg);
+              break;
+          case OPT_WORKERS:
+              psettings->workers = atoi(optarg);
+              break;
+          case OPT_SELF_JOIN:
+              psettings->self_join = TRUE;
+              break;
+          case 'd':
+              psettings->dict_file = optarg;
+              break;
+          case 'e':
+              psettings->editdist_threshold = atoi(optarg);
+              psettings->editdist_threshold_set = TRUE;
+              break;
+          case 'n':
+              psettings->adaptive_target = atoi(optarg);
+              break;
+          case 's':
+              if((strcmp(optarg,"r")==0) ||
+                      (strcmp(optarg,"a")==0)) {
+                  psettings->output_sort_order = optarg[0];
+              }
+              break;
+          case 'm':
+              if((strcmp(optarg,"levenshtein")==0) ||
+                      (strcmp(optarg,"damerau")==0)) {
+                  psettings->edit_metric = optarg[0];
+              }
+              break;
+          case 'f':
+              psettings->stop_on_match = FALSE;
+              break;
+          case 'S':
+              psettings->streaming = TRUE;
+              break;
+          case 'c':
+              psettings->compact = TRUE;
+              break;
+          case 'b':
+              psettings->shard_dir = optarg;
+              break;
+          case 'p':
+              psettings->phonetic = TRUE;
+              break;
+          case 'q':
+              psettings->qgram = TRUE;
+              break;
+          case 'i':
+              psettings->interactive = TRUE;
+              break;
+          case 'j':
+              psettings->load_threads = atoi(optarg);
+              break;
+          case 'v':
+              psettings->verbose = TRUE;
+              break;
+          case '?':
+          case 'h':
+              psettings->help = TRUE;
+              break;
+      }
   }
 
-  DBG_PRINTF("Total words = %d\n",v_word.curr_size);
-  DBG_PRINTF("Curr vector capacity = %d\n",v_word.max_word);
+}
+
+/* main
+****************/
+int main(int argc, char **argv)
+{
+  char userword[MAX_DICTWORD_LEN+1];
+  signed int i=0;
+  int exitcode = EXITCODE_SUCCESS;
+  unsigned long allocs_before = 0;
+  uint64_t start_ns = now_ns();
+  SEARCH_STATS stats = { 0 };
+  QUERY query;
+  static WORKSPACE workspace;   //Static, as it keeps the stdout buffer
+  FRONTCODED_DICT fc_dict;
+  PHONETIC_INDEX phonetic_index;
+  QGRAM_INDEX qgram_index;
+  struct stat dict_stat;
+
+  PROGRAM_SETTINGS settings =
+  {
+      .help               = FALSE,
+      .verbose            = FALSE,
+      .editdist_threshold = DEFAULT_EDITDIST_THRESHOLD,
+      .editdist_threshold_set = FALSE,
+      .adaptive_target    = 0,
+      .output_sort_order  = 'r',
+      .dict_file          = DEFAULT_DICT_FILE,
+      .stop_on_match      = TRUE,
+      .streaming          = FALSE,
+      .compact            = FALSE,
+      .shard_dir          = NULL,
+      .phonetic           = FALSE,
+      .load_threads       = 1,
+      .interactive        = FALSE,
+      .deadline_ms        = 0,
+      .workers            = 0,
+      .edit_metric        = 'l',
+      .qgram              = FALSE,
+      .self_join          = FALSE
+  };
 
-  /* Freeze the vector (free unused memory) */
-  v_word.pwordarray = realloc(v_word.pwordarray,
-          v_word.curr_size * sizeof(EDITDIST));
+  VECTOR_DICTWORD v_word =
+   {
+      .pwordarray = NULL,
+      .signatures = NULL,
+      .wordlens   = NULL,
+      .arena      = NULL,
+      .max_word   = 0,
+      .curr_size  = 0
+   };
 
-   /* Create the heap */
-  pheap = gnrcheap_create(HEAP_TYPE_MIN,
-                          v_word.curr_size,
-                          cmp_heap_elements); 
-  if(! pheap) {
-     freewordvect(&v_word);
-     return EXITCODE_FAIL_MEM;
-  } 
- 
+  VECTOR_DICTWORD v_result =
+   {
+      .pwordarray = NULL,
+      .signatures = NULL,
+      .wordlens   = NULL,
+      .arena      = NULL,
+      .max_word   = 0,
+      .curr_size  = 0
+   };
 
-  /* Calculate edit distance for each dictionary words v/s user word */
-  for(i=0; i < v_word.curr_size; i++)
+  SEARCH_CONTEXT search =
   {
-      v_word.pwordarray[i].edit_dist = calc_edit_dist(
-              userword, 
-              v_word.pwordarray[i].dict_word);
+      .psettings = &settings,
+      .pworkspace = &workspace,
+      .pquery    = &query,
+      .presults  = &v_word,
+      .pstats    = &stats,
+      .pmerge    = NULL,
+      .mergeruns = NULL
+  };
 
-      if(v_word.pwordarray[i].edit_dist == 0) {
-        //Edit distance is ZERO, means an exact match was found in
-        //the dictionary, means the user supplied word is spelled 
-        //correctly          
-        match_found = TRUE;  
-        fprintf(stdout,"Word '%s' was found in the dictionary, "
-                       "which means it is spelled correctly.\n",
-                       userword);
-        if(settings.stop_on_match) {
-            fprintf(stdout,"To see similarly spelled words, rerun this "
-                           "program with argument -f\n");
-        }
-        else {
-            fprintf(stdout,"Below is the list of similarly spelled words:\n");
-        }   
+
+  /* Field command-line arguments */
+  get_programsettings(argc,argv,&settings);
+
+  init_workspace(&workspace);
+  setvbuf(stdout, workspace.outbuff, _IOFBF, sizeof(workspace.outbuff));
+
+  /* If 'help' is requested or incorrect arguments passed ... */
+  if(settings.help) {
+      usage();
+      return (EXITCODE_SUCCESS);
+  }
+
+  /* Only the in-memory vector search (on its own or over workers) widens
+     its cutoff */
+  if(settings.adaptive_target > 0 &&
+     (settings.streaming || settings.compact || settings.phonetic ||
+      settings.qgram || settings.shard_dir || settings.interactive ||
+      settings.self_join ||
+      (stat(settings.dict_file, &dict_stat) == 0 &&
+       S_ISDIR(dict_stat.st_mode)))) {
+      fprintf(stderr, "-n is not supported with -S, -c, -p, -q, -b, -i, "
+                      "--self-join or a sharded dictionary\n");
+      return (EXITCODE_FAIL_USAGE);
+  }
+
+  /* Preprocessing only, no word to look up */
+  if(settings.shard_dir) {
+      return build_shards(&settings);
+  }
+
+  /* Worker processes hold their part as an in-memory vector */
+  if(settings.workers > 1 && 
+     (settings.streaming || settings.compact || settings.phonetic ||
+      settings.qgram)) {
+      fprintf(stderr, "--workers is not supported with -S, -c, -p or -q\n");
+      return (EXITCODE_FAIL_USAGE);
+  }
+
+  /* The deadline is that of a single lookup */
+  if(settings.deadline_ms > 0 && (settings.self_join || settings.interactive)) {
+      fprintf(stderr, "--deadline-ms is not supported with %s\n",
+                      settings.self_join ? "--self-join" : "-i");
+      return (EXITCODE_FAIL_USAGE);
+  }
+
+  /* Dictionary against itself, no word to look up */
+  if(settings.self_join) {
+      exitcode = load_vector(&settings, &v_word, &workspace);
+      if(exitcode == EXITCODE_SUCCESS) {
+          exitcode = self_join(&settings, &v_word, &workspace);
+      }
+      freewordvect(&v_word);
+      free_workspace(&workspace);
+      return (exitcode);
+  }
+
+  /* Interactive, words keep coming through stdin */
+  if(settings.interactive && settings.edit_metric == 'd') {
+      fprintf(stderr, "-m damerau is not supported with -i\n");
+      return (EXITCODE_FAIL_USAGE);
+  }
+  if(settings.interactive) {
+      exitcode = load_vector(&settings, &v_word, &workspace);
+      if(exitcode == EXITCODE_SUCCESS) {
+          query.match_found = FALSE;
+          exitcode = interactive_lookup(&search, &v_word);
       }
-      else {
-        gnrcheap_insert(pheap,&v_word.pwordarray[i]); 
+      freewordvect(&v_word);
+      free_workspace(&workspace);
+      return (exitcode);
+  }
+
+  /* Get hold of the word user is interested in */
+  if(optind < argc) {
+      //User has supplied the word on command-line
+      strncpy(userword,argv[optind],sizeof(userword)-1);
+      userword[sizeof(userword)-1] = '\0'; //Handle with grace, if
+                                           //user-supplied word is too long
+  }
+  else {
+      //User has not supplied the word on command-line, read thru stdin
+      fgets(userword,sizeof(userword),stdin);
+      i = strlen(userword);
+      if(userword[i-1] == '\n') {
+          userword[i-1] = '\0';
       }
+
+  }
+
+
+  /* Convert user word to lower case */
+  strlwr_inplace(userword);
+  init_query(&query, userword, settings.editdist_threshold);
+  if(settings.deadline_ms > 0) {
+      query.deadline_ns = start_ns + (uint64_t)settings.deadline_ms*1000000;
   }
 
-  if((match_found == FALSE) ||
-     (match_found == TRUE && settings.stop_on_match == FALSE)) {     
-      /* Show dictionary words and edit distances to the user word 
-         in alphabetical order, if that is requested */
-      if(settings.output_sort_order == 'a') {
-          for(i=0; i < v_word.curr_size; i++) {
-              if(v_word.pwordarray[i].edit_dist && 
-                 v_word.pwordarray[i].edit_dist <= settings.editdist_threshold) {
-                  if(!settings.verbose) {
-                      fprintf(stdout,"%s\n",v_word.pwordarray[i].dict_word);
-                  }
-                  else {
-                      fprintf(stdout,"%s\t=>\t%-15s\tedit-dist=%d\n", 
-                              userword, 
-                              v_word.pwordarray[i].dict_word,
-                              v_word.pwordarray[i].edit_dist);
-                  }
+
+  if(stat(settings.dict_file, &dict_stat) == 0 && 
+     S_ISDIR(dict_stat.st_mode)) {
+      /* Sharded dictionary, read the relevant shards only */
+      allocs_before = get_alloc_count();
+      DH_TRACE2(query__start, userword, settings.editdist_threshold);
+      exitcode = search_shards(&search);
+  }
+  else if(settings.workers > 1 &&
+          !dictionary_is_gzip(settings.dict_file)) {
+      /* Spread over worker processes, each holding a part (byte ranges
+         of the file, which a compressed one does not have) */
+      allocs_before = get_alloc_count();
+      DH_TRACE2(query__start, userword, settings.editdist_threshold);
+      exitcode = search_workers(&search);
+  }
+  else if(settings.streaming) {
+      /* Score while reading, keep only the suggestions */
+      allocs_before = get_alloc_count();
+      DH_TRACE2(query__start, userword, settings.editdist_threshold);
+      exitcode = search_stream(&search);
+  }
+  else if(settings.compact) {
+      /* Read all dictionary words front-coded, then score them */
+      init_frontcoded(&fc_dict);
+      exitcode = load_dictionary(&settings, frontcoded_visit_word, &fc_dict);
+      if(exitcode == EXITCODE_SUCCESS) {
+          freeze_frontcoded(&fc_dict);
+          allocs_before = get_alloc_count();
+          DH_TRACE2(query__start, userword, settings.editdist_threshold);
+          exitcode = search_frontcoded(&search, &fc_dict);
+      }
+      free_frontcoded(&fc_dict);
+  }
+  else {
+      /* Read all dictionary words, then score them */
+      exitcode = load_vector(&settings, &v_word, &workspace);
+      if(exitcode == EXITCODE_SUCCESS) {
+          if(settings.phonetic) {
+              /* Candidates come from the phonetic index, and results
+                 go to a vector of their own */
+              exitcode = build_phonetic_index(&phonetic_index, &v_word);
+              if(exitcode == EXITCODE_SUCCESS) {
+                  search.presults = &v_result;
+                  allocs_before = get_alloc_count();
+                  DH_TRACE2(query__start, userword,
+                            settings.editdist_threshold);
+                  exitcode = search_phonetic(&search, &v_word, 
+                                             &phonetic_index);
+                  free_phonetic_index(&phonetic_index);
               }
           }
-      } 
-
-
-      /* Show dictionary words and edit distances to the user word 
-         in relevancy order (edit distance), if that is requested */
-      if(settings.output_sort_order == 'r') {
-          while(pworddist = gnrcheap_getmin(pheap))
-          {
-              if(pworddist->edit_dist <= settings.editdist_threshold) {
-                  if(!settings.verbose) {
-                      fprintf(stdout,"%s\n",pworddist->dict_word);
-                  }
-                  else {
-                      fprintf(stdout,"%s\t=>\t%-15s\tedit-dist=%d\n", 
-                              userword, 
-                              pworddist->dict_word,
-                              pworddist->edit_dist);
-                  }
-                  gnrcheap_delmin(pheap,NULL);
-              } 
-              else {
-                  break;
+          else if(settings.qgram) {
+              /* Candidates come from the bigram index, results go to a
+                 vector of their own */
+              exitcode = build_qgram_index(&qgram_index, &v_word);
+              if(exitcode == EXITCODE_SUCCESS) {
+                  search.presults = &v_result;
+                  allocs_before = get_alloc_count();
+                  DH_TRACE2(query__start, userword,
+                            settings.editdist_threshold);
+                  exitcode = search_qgram(&search, &v_word, &qgram_index);
+                  free_qgram_index(&qgram_index);
               }
           }
+          else {
+              allocs_before = get_alloc_count();
+              DH_TRACE2(query__start, userword, settings.editdist_threshold);
+              exitcode = search_vector(&search);
+          }
       }
   }
 
+  if(exitcode == EXITCODE_SUCCESS) {
+      exitcode = show_suggestions(&search);
+      stats.allocs = get_alloc_count() - allocs_before;
+  }
+  DH_TRACE3(query__end, userword, stats.words_scored, stats.words_accepted);
+
+  if(exitcode == EXITCODE_SUCCESS && stats.incomplete) {
+      fprintf(stdout,"Search stopped at the deadline of %d ms, %d candidate "
+                     "words were not looked at.\n"
+                     "Above suggestions are the best found so far.\n",
+                     settings.deadline_ms, stats.words_unscanned);
+  }
+
+  if(exitcode == EXITCODE_SUCCESS && settings.verbose) {
+      show_statistics(&stats);
+  }
+
   /* Return the memory */
-  gnrcheap_destroy(pheap,NULL); 
   freewordvect(&v_word);
+  freewordvect(&v_result);
+  free_workspace(&workspace);
+  if(search.pmerge) {
+      gnrcheap_merge_destroy(search.pmerge);
+  }
+  free(search.mergeruns);
 
 
   return (exitcode);
-}    
-
+}
@@ -17,6 +17,7 @@
 #include <memory.h>
 #include <assert.h>
 #include "common/common_types.h"
+#include "common/trace.h"
 #include "gnrcheap.h"
 
 /* Prototypes
@@ -75,6 +76,22 @@ PGNRCHEAP gnrcheap_create(HEAP_TYPE heaptype,
 	return pheap;
 }
 
+/* Set up a heap over caller owned storage, heaparr must have room for
+   capacity+1 elements (offset 0 is not used). Such a heap is not to be
+   passed to gnrcheap_destroy(), the caller frees (or reuses) both */
+VOID gnrcheap_init(PGNRCHEAP pheap,
+				   HEAP_TYPE heaptype,
+				   PVOID *heaparr,
+				   uint32_t capacity,
+				   PFN_HEAPELEMENT_CMP pfnheapelecmp)
+{
+	pheap->type		     = heaptype;
+	pheap->heaparr       = heaparr;
+	pheap->capacity      = capacity + 1;
+	pheap->occupancy     = 0;
+	pheap->pfnheapelecmp = pfnheapelecmp;
+}
+
 VOID gnrcheap_destroy(PGNRCHEAP pheap, 
 					  PFN_HEAPELEMENT_DEL pfnheapeledel)
 {
@@ -126,6 +143,7 @@ void gnrcheap_delmin(PGNRCHEAP pheap,PFN_HEAPELEMENT_DEL pfnheapeledel)
 {
 	if(pheap->type == HEAP_TYPE_MIN) {
 		gnrcheap_delroot(pheap,pfnheapeledel);
+		DH_TRACE2(heap__delmin,pheap,pheap->occupancy);
 	}
 
 }
@@ -188,7 +206,9 @@ VOID gnrcheap_bottomup(PGNRCHEAP pheap)
 
 BOOL  gnrcheap_insert(PGNRCHEAP pheap,PVOID pnewele) {
 	
-	if((pheap->occupancy+1) > pheap->capacity) {
+	//NOTE: capacity counts offset 0 too, which is not used
+	if((pheap->occupancy+1) >= pheap->capacity) {
+		DH_TRACE2(heap__full,pheap,pheap->occupancy);
 		return FALSE;
 	}
 
@@ -196,6 +216,7 @@ BOOL  gnrcheap_insert(PGNRCHEAP pheap,PVOID pnewele) {
 	pheap->heaparr[pheap->occupancy] = pnewele;
 	
 	gnrcheap_siftup(pheap);
+	DH_TRACE2(heap__insert,pheap,pheap->occupancy);
 
     return TRUE;	
 }
@@ -468,3 +489,307 @@ HEAP_OFFSET gnrcheap_maxofparentchild(PGNRCHEAP pheap,
 	return parent;
 }
 
+
+
+/* Insert a batch of elements. A batch large compared to what the heap
+   already holds is appended as is and the heap rebuilt bottom-up in one go,
+   otherwise elements are sifted up one by one */
+BOOL  gnrcheap_insertbatch(PGNRCHEAP pheap,
+						   PVOID *pneweles,
+						   uint32_t count)
+{
+	uint32_t i = 0;
+
+	//NOTE: capacity counts offset 0 too, which is not used
+	if((pheap->occupancy+count) >= pheap->capacity) {
+		return FALSE;
+	}
+
+	if(count > pheap->occupancy) {
+		memcpy(&pheap->heaparr[pheap->occupancy+1],
+			   pneweles,
+			   count * sizeof(PVOID));
+		pheap->occupancy += count;
+		gnrcheap_bottomup(pheap);
+	}
+	else {
+		for(i=0;i<count;i++) {
+			gnrcheap_insert(pheap,pneweles[i]);
+		}
+	}
+
+	return TRUE;
+}
+
+
+/* K-way merge
+****************/
+
+PVOID gnrcheap_merge_srchead(PGNRCHEAP_MERGE_SRC psrc)
+{
+	if(psrc->pheap) {
+		return gnrcheap_getroot(psrc->pheap);
+	}
+
+	if(psrc->runnext < psrc->runlen) {
+		return psrc->run[psrc->runnext];
+	}
+
+	return NULL;
+}
+
+/* Sources compare as their next elements do */
+int gnrcheap_merge_cmpsrc(PVOID psrc1, PVOID psrc2)
+{
+	PGNRCHEAP_MERGE_SRC src1 = (PGNRCHEAP_MERGE_SRC) psrc1;
+	PGNRCHEAP_MERGE_SRC src2 = (PGNRCHEAP_MERGE_SRC) psrc2;
+
+	return (*src1->pfnheapelecmp)(gnrcheap_merge_srchead(src1),
+								  gnrcheap_merge_srchead(src2));
+}
+
+PGNRCHEAP_MERGE gnrcheap_merge_create(HEAP_TYPE heaptype,
+									  uint32_t maxsources,
+									  PFN_HEAPELEMENT_CMP pfnheapelecmp)
+{
+	PGNRCHEAP_MERGE pmerge = NULL;
+
+	if(!(heaptype==HEAP_TYPE_MIN || heaptype==HEAP_TYPE_MAX)) {
+		return NULL;
+	}
+
+	pmerge = malloc(sizeof(GNRCHEAP_MERGE));
+	if(!pmerge) {
+		return NULL;
+	}
+	memset(pmerge,0,sizeof(*pmerge));
+
+	pmerge->sources = malloc(sizeof(GNRCHEAP_MERGE_SRC) * maxsources);
+	pmerge->srcheaparr = malloc(sizeof(PVOID) * (maxsources+1));
+	if(!pmerge->sources || !pmerge->srcheaparr) {
+		free(pmerge->sources);
+		free(pmerge->srcheaparr);
+		free(pmerge);
+		return NULL;
+	}
+
+	gnrcheap_init(&pmerge->srcheap,
+				  heaptype,
+				  pmerge->srcheaparr,
+				  maxsources,
+				  gnrcheap_merge_cmpsrc);
+	pmerge->maxsources    = maxsources;
+	pmerge->pfnheapelecmp = pfnheapelecmp;
+
+	return pmerge;
+}
+
+VOID gnrcheap_merge_destroy(PGNRCHEAP_MERGE pmerge)
+{
+	free(pmerge->sources);
+	free(pmerge->srcheaparr);
+	free(pmerge);
+}
+
+BOOL gnrcheap_merge_addsrc(PGNRCHEAP_MERGE pmerge,
+						   PGNRCHEAP pheap,
+						   PVOID *run,
+						   uint32_t runlen)
+{
+	PGNRCHEAP_MERGE_SRC psrc = NULL;
+
+	if(pmerge->nsources == pmerge->maxsources) {
+		return FALSE;
+	}
+
+	psrc = &pmerge->sources[pmerge->nsources++];
+	psrc->pheap         = pheap;
+	psrc->run           = run;
+	psrc->runlen        = runlen;
+	psrc->runnext       = 0;
+	psrc->pfnheapelecmp = pmerge->pfnheapelecmp;
+
+	/* Empty sources need not take part */
+	if(gnrcheap_merge_srchead(psrc)) {
+		gnrcheap_insert(&pmerge->srcheap,psrc);
+	}
+
+	return TRUE;
+}
+
+/* The heap is drained by the merge, it must not be touched until the
+   merge is over */
+BOOL gnrcheap_merge_addheap(PGNRCHEAP_MERGE pmerge,PGNRCHEAP pheap)
+{
+	if(pheap->type != pmerge->srcheap.type) {
+		return FALSE;
+	}
+
+	return gnrcheap_merge_addsrc(pmerge,pheap,NULL,0);
+}
+
+/* The run must already be in the merge's order (ascending for a MIN
+   merge, descending for a MAX one) */
+BOOL gnrcheap_merge_addrun(PGNRCHEAP_MERGE pmerge,
+						   PVOID *run,
+						   uint32_t runlen)
+{
+	return gnrcheap_merge_addsrc(pmerge,NULL,run,runlen);
+}
+
+/* Next element of the merged output, NULL once all sources are drained */
+PVOID gnrcheap_merge_next(PGNRCHEAP_MERGE pmerge)
+{
+	PGNRCHEAP_MERGE_SRC psrc = gnrcheap_getroot(&pmerge->srcheap);
+	PVOID pele = NULL;
+
+	if(!psrc) {
+		return NULL;
+	}
+
+	pele = gnrcheap_merge_srchead(psrc);
+
+	/* Advance the source, then let it find its new place */
+	if(psrc->pheap) {
+		gnrcheap_delroot(psrc->pheap,NULL);
+	}
+	else {
+		psrc->runnext++;
+	}
+
+	gnrcheap_delroot(&pmerge->srcheap,NULL);
+	if(gnrcheap_merge_srchead(psrc)) {
+		gnrcheap_insert(&pmerge->srcheap,psrc);
+	}
+
+	return pele;
+}
+
+
+/* Sharded heap
+*****************/
+
+PGNRCHEAP_SHARDED gnrcheap_sharded_create(HEAP_TYPE heaptype,
+										  uint32_t nshards,
+										  uint32_t shardcapacity,
+										  PFN_HEAPELEMENT_CMP pfnheapelecmp)
+{
+	PGNRCHEAP_SHARDED psharded = NULL;
+	uint32_t i = 0;
+
+	if(nshards == 0) {
+		return NULL;
+	}
+
+	psharded = malloc(sizeof(GNRCHEAP_SHARDED));
+	if(!psharded) {
+		return NULL;
+	}
+	memset(psharded,0,sizeof(*psharded));
+
+	psharded->shards = malloc(sizeof(PGNRCHEAP) * nshards);
+	psharded->locks = malloc(sizeof(pthread_mutex_t) * nshards);
+	if(!psharded->shards || !psharded->locks) {
+		free(psharded->shards);
+		free(psharded->locks);
+		free(psharded);
+		return NULL;
+	}
+
+	for(i=0;i<nshards;i++) {
+		psharded->shards[i] = gnrcheap_create(heaptype,
+											  shardcapacity,
+											  pfnheapelecmp);
+		if(!psharded->shards[i]) {
+			psharded->nshards = i;
+			gnrcheap_sharded_destroy(psharded,NULL);
+			return NULL;
+		}
+		pthread_mutex_init(&psharded->locks[i],NULL);
+	}
+
+	psharded->type          = heaptype;
+	psharded->nshards       = nshards;
+	psharded->pfnheapelecmp = pfnheapelecmp;
+
+	return psharded;
+}
+
+VOID gnrcheap_sharded_destroy(PGNRCHEAP_SHARDED psharded,
+							  PFN_HEAPELEMENT_DEL pfnheapeledel)
+{
+	uint32_t i = 0;
+
+	for(i=0;i<psharded->nshards;i++) {
+		gnrcheap_destroy(psharded->shards[i],pfnheapeledel);
+		pthread_mutex_destroy(&psharded->locks[i]);
+	}
+
+	free(psharded->shards);
+	free(psharded->locks);
+	free(psharded);
+}
+
+/* Producers should pass distinct hints (a thread number, say) to keep
+   off each other's locks. A full shard passes the element on to the
+   next one */
+BOOL gnrcheap_sharded_insert(PGNRCHEAP_SHARDED psharded,
+							 uint32_t shardhint,
+							 PVOID pnewele)
+{
+	uint32_t shard = 0;
+	uint32_t i = 0;
+	BOOL inserted = FALSE;
+
+	for(i=0;i<psharded->nshards && !inserted;i++) {
+		shard = (shardhint + i) % psharded->nshards;
+		pthread_mutex_lock(&psharded->locks[shard]);
+		inserted = gnrcheap_insert(psharded->shards[shard],pnewele);
+		pthread_mutex_unlock(&psharded->locks[shard]);
+	}
+
+	return inserted;
+}
+
+/* Remove and return the best element of all shards (min or max, as per
+   the heap type), NULL if all shards are empty.
+   Locks are taken in shard order, so concurrent pops can not deadlock */
+PVOID gnrcheap_sharded_pop(PGNRCHEAP_SHARDED psharded)
+{
+	PVOID pbest = NULL;
+	PVOID proot = NULL;
+	uint32_t bestshard = 0;
+	uint32_t i = 0;
+	int cmp = 0;
+
+	for(i=0;i<psharded->nshards;i++) {
+		pthread_mutex_lock(&psharded->locks[i]);
+	}
+
+	for(i=0;i<psharded->nshards;i++) {
+		proot = gnrcheap_getroot(psharded->shards[i]);
+		if(!proot) {
+			continue;
+		}
+		if(pbest) {
+			cmp = (*psharded->pfnheapelecmp)(proot,pbest);
+			if(psharded->type == HEAP_TYPE_MAX) {
+				cmp = -cmp;
+			}
+		}
+		if(!pbest || cmp < 0) {
+			pbest = proot;
+			bestshard = i;
+		}
+	}
+
+	if(pbest) {
+		gnrcheap_delroot(psharded->shards[bestshard],NULL);
+	}
+
+	for(i=psharded->nshards;i>0;i--) {
+		pthread_mutex_unlock(&psharded->locks[i-1]);
+	}
+
+	return pbest;
+}
@@ -14,6 +14,7 @@
 
 /* Includes
 **************/
+#include <pthread.h>
 #include "common/common_types.h"
 
 /* Type definitions
@@ -40,11 +41,46 @@ typedef struct gnrcheap {
 		PFN_HEAPELEMENT_CMP pfnheapelecmp;
 } GNRCHEAP, * PGNRCHEAP;
 
+/* One input of a k-way merge: either a heap (drained as the merge goes)
+   or a run of elements already sorted in the merge's order */
+typedef struct gnrcheap_merge_src {
+		PGNRCHEAP   pheap;
+		PVOID	   *run;
+		uint32_t	runlen;
+		uint32_t	runnext;	/* Next element of the run */
+		PFN_HEAPELEMENT_CMP pfnheapelecmp;
+} GNRCHEAP_MERGE_SRC, * PGNRCHEAP_MERGE_SRC;
+
+typedef struct gnrcheap_merge {
+		GNRCHEAP	srcheap;	/* Sources, keyed by their next element */
+		PVOID	   *srcheaparr;
+		PGNRCHEAP_MERGE_SRC sources;
+		uint32_t	nsources;
+		uint32_t	maxsources;
+		PFN_HEAPELEMENT_CMP pfnheapelecmp;
+} GNRCHEAP_MERGE, * PGNRCHEAP_MERGE;
+
+/* Heap split into shards, each behind a lock of its own, for several
+   producers to insert concurrently. Pops take the best root of all 
+   shards */
+typedef struct gnrcheap_sharded {
+		HEAP_TYPE   type;
+		PGNRCHEAP  *shards;
+		pthread_mutex_t *locks;
+		uint32_t	nshards;
+		PFN_HEAPELEMENT_CMP pfnheapelecmp;
+} GNRCHEAP_SHARDED, * PGNRCHEAP_SHARDED;
+
 /* Prototypes
 ***************/
 PGNRCHEAP gnrcheap_create(HEAP_TYPE heaptype,
 						  uint32_t capacity, 
 					      PFN_HEAPELEMENT_CMP pfnheapelecmp); 
+VOID gnrcheap_init(PGNRCHEAP pheap,
+				   HEAP_TYPE heaptype,
+				   PVOID *heaparr,
+				   uint32_t capacity,
+				   PFN_HEAPELEMENT_CMP pfnheapelecmp);
 VOID gnrcheap_destroy(PGNRCHEAP pheap,
 	                  PFN_HEAPELEMENT_DEL pfnheapeledel); 
 VOID gnrcheap_bottomup(PGNRCHEAP pheap);
@@ -53,5 +89,29 @@ PVOID gnrcheap_getmin(PGNRCHEAP pheap);
 void gnrcheap_delmin(PGNRCHEAP pheap,PFN_HEAPELEMENT_DEL pfnheapeledel);
 void gnrcheap_delmax(PGNRCHEAP pheap,PFN_HEAPELEMENT_DEL pfnheapeledel);
 BOOL  gnrcheap_insert(PGNRCHEAP pheap,PVOID pnewele);
+BOOL  gnrcheap_insertbatch(PGNRCHEAP pheap,
+						   PVOID *pneweles,
+						   uint32_t count);
+
+PGNRCHEAP_MERGE gnrcheap_merge_create(HEAP_TYPE heaptype,
+									  uint32_t maxsources,
+									  PFN_HEAPELEMENT_CMP pfnheapelecmp);
+VOID gnrcheap_merge_destroy(PGNRCHEAP_MERGE pmerge);
+BOOL gnrcheap_merge_addheap(PGNRCHEAP_MERGE pmerge,PGNRCHEAP pheap);
+BOOL gnrcheap_merge_addrun(PGNRCHEAP_MERGE pmerge,
+						   PVOID *run,
+						   uint32_t runlen);
+PVOID gnrcheap_merge_next(PGNRCHEAP_MERGE pmerge);
+
+PGNRCHEAP_SHARDED gnrcheap_sharded_create(HEAP_TYPE heaptype,
+										  uint32_t nshards,
+										  uint32_t shardcapacity,
+										  PFN_HEAPELEMENT_CMP pfnheapelecmp);
+VOID gnrcheap_sharded_destroy(PGNRCHEAP_SHARDED psharded,
+							  PFN_HEAPELEMENT_DEL pfnheapeledel);
+BOOL gnrcheap_sharded_insert(PGNRCHEAP_SHARDED psharded,
+							 uint32_t shardhint,
+							 PVOID pnewele);
+PVOID gnrcheap_sharded_pop(PGNRCHEAP_SHARDED psharded);
 
 #endif
@@ -0,0 +1,381 @@
+
+/********************************************************************
+*  Licence: The MIT license
+*  Author:  See accompanied AUTHORS.txt
+*
+*  File: gnrcheap_test.c
+*  Description: Stress tests of the generic heap (plain, batch insert,
+*               k-way merge, sharded) against qsort, and a throughput
+*               benchmark of the sharded heap against the plain one.
+*               Run through 'make test'
+*
+********************************************************************/
+
+
+/* Includes
+***************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "gnrcheap.h"
+
+
+/* Constants
+***************/
+#define MERGE_ROUNDS          200
+#define MERGE_MAX_SOURCES     6
+#define MERGE_MAX_HEAP        500
+#define MERGE_RUN_LEN         50
+
+#define MAX_PRODUCERS         8
+#define PRODUCER_ELEMENTS     100000
+
+#define BENCH_ELEMENTS        (4*PRODUCER_ELEMENTS)
+
+
+/* Structures
+***************/
+typedef struct {
+	pthread_t			thread;
+	PGNRCHEAP_SHARDED	psharded;
+	uint32_t			hint;
+	long				*values;
+	int					count;
+	BOOL				failed;
+} PRODUCER, *P_PRODUCER;
+
+typedef struct {
+	pthread_t			thread;
+	PGNRCHEAP_SHARDED	psharded;
+	long				*popped;
+	int					count;
+	int					expected;
+} CONSUMER, *P_CONSUMER;
+
+
+/* Globals
+***************/
+static int failures = 0;
+
+
+/* routines
+***************/
+
+/* Elements are plain positive longs, stored in the pointers themselves */
+int cmp_long_elements(PVOID pele1, PVOID pele2)
+{
+	long val1 = (long)pele1;
+	long val2 = (long)pele2;
+
+	return (val1 > val2) - (val1 < val2);
+}
+
+int cmp_longs(const void *p1, const void *p2)
+{
+	return cmp_long_elements((PVOID)*(long *)p1, (PVOID)*(long *)p2);
+}
+
+void check(BOOL condition, const char *what)
+{
+	if(!condition) {
+		fprintf(stderr, "FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+double elapsed(struct timespec *pstart)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - pstart->tv_sec) +
+	       (now.tv_nsec - pstart->tv_nsec) / 1e9;
+}
+
+long *random_values(int count, unsigned int *pseed)
+{
+	long *values = malloc((count + 1) * sizeof(long));
+	int i = 0;
+
+	for(i=0; values && i < count; i++) {
+		values[i] = rand_r(pseed) % 1000000 + 1;
+	}
+
+	return values;
+}
+
+
+
+/* Plain heap: mixed inserts and single/batch inserts, drained in order */
+void test_plain(void)
+{
+	unsigned int seed = 1;
+	int count = 10000;
+	long *values = random_values(count, &seed);
+	PGNRCHEAP pheap = gnrcheap_create(HEAP_TYPE_MIN, count, cmp_long_elements);
+	int half = count / 2;
+	BOOL ok = TRUE;
+	int i = 0;
+
+	for(i=0; i < half; i++) {
+		ok &= gnrcheap_insert(pheap, (PVOID)values[i]);
+	}
+	ok &= gnrcheap_insertbatch(pheap, (PVOID *)(values + half), count - half);
+	check(ok, "plain: inserts within capacity");
+	check(!gnrcheap_insert(pheap, (PVOID)1L), "plain: insert beyond capacity");
+
+	qsort(values, count, sizeof(long), cmp_longs);
+	for(i=0; i < count; i++) {
+		if((long)gnrcheap_getmin(pheap) != values[i]) {
+			ok = FALSE;
+			break;
+		}
+		gnrcheap_delmin(pheap, NULL);
+	}
+	check(ok, "plain: drained in qsort order");
+	check(gnrcheap_getmin(pheap) == NULL, "plain: empty once drained");
+
+	gnrcheap_destroy(pheap, NULL);
+	free(values);
+}
+
+
+
+/* k-way merge of heaps and a sorted run, against qsort of everything */
+void test_merge(void)
+{
+	unsigned int seed = 2;
+	PGNRCHEAP heaps[MERGE_MAX_SOURCES];
+	long run[MERGE_RUN_LEN];
+	long *all = NULL;
+	PVOID *batch = NULL;
+	PGNRCHEAP_MERGE pmerge = NULL;
+	int round = 0;
+	int nheaps = 0;
+	int size = 0;
+	int half = 0;
+	int total = 0;
+	int i = 0;
+	int k = 0;
+	BOOL ok = TRUE;
+
+	for(round=0; round < MERGE_ROUNDS && ok; round++) {
+		nheaps = rand_r(&seed) % (MERGE_MAX_SOURCES - 1) + 1;
+		all = malloc((nheaps * MERGE_MAX_HEAP + MERGE_RUN_LEN) * sizeof(long));
+		batch = malloc((MERGE_MAX_HEAP + 1) * sizeof(PVOID));
+		pmerge = gnrcheap_merge_create(HEAP_TYPE_MIN, nheaps + 1,
+									   cmp_long_elements);
+		total = 0;
+
+		for(k=0; k < nheaps; k++) {
+			heaps[k] = gnrcheap_create(HEAP_TYPE_MIN, MERGE_MAX_HEAP,
+									   cmp_long_elements);
+			size = rand_r(&seed) % (MERGE_MAX_HEAP + 1);
+			half = size / 2;
+			for(i=0; i < size; i++) {
+				all[total] = rand_r(&seed) % 1000 + 1;
+				if(i < half) {
+					gnrcheap_insert(heaps[k], (PVOID)all[total]);
+				}
+				else {
+					batch[i - half] = (PVOID)all[total];
+				}
+				total++;
+			}
+			ok &= gnrcheap_insertbatch(heaps[k], batch, size - half);
+			ok &= gnrcheap_merge_addheap(pmerge, heaps[k]);
+		}
+
+		for(i=0; i < MERGE_RUN_LEN; i++) {
+			run[i] = all[total++] = rand_r(&seed) % 1000 + 1;
+		}
+		qsort(run, MERGE_RUN_LEN, sizeof(long), cmp_longs);
+		ok &= gnrcheap_merge_addrun(pmerge, (PVOID *)run, MERGE_RUN_LEN);
+
+		qsort(all, total, sizeof(long), cmp_longs);
+		for(i=0; i < total && ok; i++) {
+			ok = ((long)gnrcheap_merge_next(pmerge) == all[i]);
+		}
+		ok &= (gnrcheap_merge_next(pmerge) == NULL);
+
+		gnrcheap_merge_destroy(pmerge);
+		for(k=0; k < nheaps; k++) {
+			gnrcheap_destroy(heaps[k], NULL);
+		}
+		free(batch);
+		free(all);
+	}
+
+	check(ok, "merge: heaps and run merged in qsort order");
+}
+
+
+
+void *producer(void *arg)
+{
+	P_PRODUCER pproducer = (P_PRODUCER) arg;
+	int i = 0;
+
+	for(i=0; i < pproducer->count; i++) {
+		if(!gnrcheap_sharded_insert(pproducer->psharded, pproducer->hint,
+									(PVOID)pproducer->values[i])) {
+			pproducer->failed = TRUE;
+		}
+	}
+
+	return NULL;
+}
+
+
+
+void *consumer(void *arg)
+{
+	P_CONSUMER pconsumer = (P_CONSUMER) arg;
+	PVOID pele = NULL;
+
+	while(pconsumer->count < pconsumer->expected) {
+		pele = gnrcheap_sharded_pop(pconsumer->psharded);
+		if(pele) {
+			pconsumer->popped[pconsumer->count++] = (long)pele;
+		}
+	}
+
+	return NULL;
+}
+
+
+
+/* Run nproducers producers (and a concurrent consumer if asked to) on a
+   sharded heap. Every element must come out exactly once, in order when
+   nothing is popped concurrently. Returns the seconds taken to insert */
+double run_sharded(int nproducers, BOOL concurrent_pop)
+{
+	PRODUCER producers[MAX_PRODUCERS];
+	CONSUMER cons;
+	unsigned int seed = 3;
+	int total = nproducers * PRODUCER_ELEMENTS;
+	long *all = malloc(total * sizeof(long));
+	long *popped = malloc(total * sizeof(long));
+	PGNRCHEAP_SHARDED psharded = NULL;
+	struct timespec start;
+	double seconds = 0;
+	PVOID pele = NULL;
+	BOOL ok = TRUE;
+	int count = 0;
+	int i = 0;
+
+	/* One shard per producer, just large enough for its elements */
+	psharded = gnrcheap_sharded_create(HEAP_TYPE_MIN, nproducers,
+									   PRODUCER_ELEMENTS, cmp_long_elements);
+
+	for(i=0; i < nproducers; i++) {
+		producers[i].psharded = psharded;
+		producers[i].hint     = i;
+		producers[i].values   = random_values(PRODUCER_ELEMENTS, &seed);
+		producers[i].count    = PRODUCER_ELEMENTS;
+		producers[i].failed   = FALSE;
+		memcpy(all + i*PRODUCER_ELEMENTS, producers[i].values,
+			   PRODUCER_ELEMENTS * sizeof(long));
+	}
+
+	cons.psharded = psharded;
+	cons.popped   = popped;
+	cons.count    = 0;
+	cons.expected = total;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i=0; i < nproducers; i++) {
+		pthread_create(&producers[i].thread, NULL, producer, &producers[i]);
+	}
+	if(concurrent_pop) {
+		pthread_create(&cons.thread, NULL, consumer, &cons);
+	}
+	for(i=0; i < nproducers; i++) {
+		pthread_join(producers[i].thread, NULL);
+		ok &= !producers[i].failed;
+	}
+	seconds = elapsed(&start);
+
+	if(concurrent_pop) {
+		pthread_join(cons.thread, NULL);
+		count = cons.count;
+		qsort(popped, count, sizeof(long), cmp_longs);
+	}
+	else {
+		while(pele = gnrcheap_sharded_pop(psharded)) {
+			popped[count++] = (long)pele;
+		}
+	}
+	check(ok, "sharded: all inserts accepted");
+
+	qsort(all, total, sizeof(long), cmp_longs);
+	ok = (count == total) && memcmp(all, popped, total * sizeof(long)) == 0;
+	check(ok, concurrent_pop ?
+			  "sharded: concurrent pops return every element once" :
+			  "sharded: popped in qsort order");
+
+	gnrcheap_sharded_destroy(psharded, NULL);
+	for(i=0; i < nproducers; i++) {
+		free(producers[i].values);
+	}
+	free(all);
+	free(popped);
+
+	return seconds;
+}
+
+
+
+/* Inserting BENCH_ELEMENTS: plain heap from one thread, then the sharded
+   heap from 1, 2 and 4 producers */
+void benchmark(void)
+{
+	unsigned int seed = 4;
+	long *values = random_values(BENCH_ELEMENTS, &seed);
+	PGNRCHEAP pheap = gnrcheap_create(HEAP_TYPE_MIN, BENCH_ELEMENTS,
+									  cmp_long_elements);
+	struct timespec start;
+	double seconds = 0;
+	int nproducers = 0;
+	int i = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i=0; i < BENCH_ELEMENTS; i++) {
+		gnrcheap_insert(pheap, (PVOID)values[i]);
+	}
+	seconds = elapsed(&start);
+	fprintf(stdout, "  plain heap, 1 thread      : %8.0f inserts/ms\n",
+			BENCH_ELEMENTS / seconds / 1000);
+	gnrcheap_destroy(pheap, NULL);
+	free(values);
+
+	for(nproducers=1; nproducers <= 4; nproducers *= 2) {
+		seconds = run_sharded(nproducers, FALSE);
+		fprintf(stdout, "  sharded heap, %d producers: %8.0f inserts/ms\n",
+				nproducers,
+				nproducers * PRODUCER_ELEMENTS / seconds / 1000);
+	}
+}
+
+
+
+/* main
+***************/
+int main(int argc, char **argv)
+{
+	test_plain();
+	test_merge();
+	run_sharded(MAX_PRODUCERS, FALSE);
+	run_sharded(MAX_PRODUCERS, TRUE);
+
+	fprintf(stdout, "Benchmark (%d elements per producer):\n",
+			PRODUCER_ELEMENTS);
+	benchmark();
+
+	fprintf(stdout, "%s\n", failures ? "gnrcheap tests FAILED" :
+									   "gnrcheap tests passed");
+
+	return failures ? 1 : 0;
+}